@@ -0,0 +1,67 @@
+/** @file Arena.cpp
+ *  @brief This file contains implementation of the Arena, the memory of the
+ *         objects made for one scheduling decision.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Constructor of an arena with no memory yet. */
+Arena::Arena() {
+    current = 0;
+    offset = 0;
+}
+
+/** @brief Destructor, free all blocks. */
+Arena::~Arena() {
+    for (unsigned int i = 0; i < blocks.size(); i++)
+        delete[] blocks[i];
+}
+
+/** @brief Take memory from the arena. A request that does not fit in the rest
+ *         of the block goes to the next block large enough, or a new one.
+ *  @param size The number of bytes
+ *  @param align The alignment, a power of 2
+ *  @return The memory, valid until Reset
+ */
+void* Arena::Allocate(size_t size, size_t align) {
+    while (current < blocks.size()) {
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + size <= blockSizes[current]) {
+            offset = start + size;
+            return blocks[current] + start;
+        }
+        current++;
+        offset = 0;
+    }
+
+    // new[] memory is aligned for any fundamental type
+    size_t blockSize = (size > BLOCK_SIZE) ? size : BLOCK_SIZE;
+    blocks.push_back(new char[blockSize]);
+    blockSizes.push_back(blockSize);
+    current = blocks.size() - 1;
+    offset = size;
+    return blocks[current];
+}
+
+/** @brief Give back all memory taken since the last reset, the objects in it
+ *         must be destroyed before. The blocks are kept.
+ */
+void Arena::Reset() {
+    current = 0;
+    offset = 0;
+}
+
+/** @brief Get the memory held by the arena.
+ *  @return The total size of the blocks in bytes
+ */
+size_t Arena::GetReservedBytes() const {
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < blockSizes.size(); i++)
+        bytes += blockSizes[i];
+    return bytes;
+}
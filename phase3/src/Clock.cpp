@@ -0,0 +1,55 @@
+/** @file Clock.cpp
+ *  @brief This file contains implementation of the clocks, the wall clock of 
+ *         the server and the virtual clock of a replay.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <ctime>
+
+/** @brief Get the wall clock shared by the server objects.
+ *  @return The clock, it is never deleted
+ */
+Clock* Clock::Wall() {
+    static WallClock wallClock;
+    return &wallClock;
+}
+
+/** @brief Get the time of the system.
+ *  @return The time in seconds
+ */
+time_t WallClock::Now() const {
+    return time(NULL);
+}
+
+/** @brief Constructor of a virtual clock.
+ *  @param now The start time
+ */
+VirtualClock::VirtualClock(time_t now) {
+    this->now = now;
+}
+
+/** @brief Get the virtual time.
+ *  @return The time in seconds
+ */
+time_t VirtualClock::Now() const {
+    return now;
+}
+
+/** @brief Move the clock to a time.
+ *  @param now The new time
+ */
+void VirtualClock::Set(time_t now) {
+    this->now = now;
+}
+
+/** @brief Move the clock forward.
+ *  @param seconds The number of seconds
+ */
+void VirtualClock::Advance(time_t seconds) {
+    now += seconds;
+}
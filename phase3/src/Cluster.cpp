@@ -8,85 +8,396 @@
  *  @bug No know bugs.
  */
 #include "inter.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
 #include <stdio.h>
 
+/** @brief The kinds of parts hashed into Cluster::stateHash */
+enum {
+    HASH_MACHINE = 1,   /* machine id, owner job id */
+    HASH_PENDING,       /* pending job id */
+    HASH_RUNNING,       /* running job id, finish time */
+    HASH_SEARCH,        /* search step and end job, current time */
+    HASH_FREE_COUNT,    /* rack, free machines on it, hashed into Cluster::freeCountHash */
+    HASH_PLACEMENT      /* job type, k */
+};
+
 /** @brief Construcor. Create a snapshot of the currrent scheduler
  *  @param racks The vector of Machines of every rack
  *  @param pendingjoblist The list contains all pending jobs
- *  @param runningjoblist The priority queue contains all running jobs
- *  @param maxmachinesperrack The number of max machines
+ *  @param runningjoblist The heap contains all running jobs
+ *  @param topology The rack layout, it must outlive the cluster
  *  @param isSoft true if the policy is soft, else false
+ *  @param arena The memory of the copied jobs, it is reset after Clear. NULL to use the heap
  */
 Cluster::Cluster(std::vector<std::vector<MyMachine> > & racks, 
-            std::list<MyJob*> & pendingJobList,
-            std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> & runningJobList,
-            int maxMachinesPerRack, bool isSoft) {
+            const std::list<MyJob*> & pendingJobList,
+            const RunningHeap & runningJobList, const Topology* topology, bool isSoft,
+            Arena* arena) 
+            : pendingJobList(ArenaAllocator<MyJob*>(arena)), 
+              startedJobList(ArenaAllocator<MyJob*>(arena)),
+              placementCache(PLACEMENT_CACHE_SIZE) {
+
+    this->topology = topology;
+    this->arena = arena;
+    this->maxMachinesPerRack = topology->GetMaxMachinesPerRack();
+    this->table = NULL;
+    this->pool = NULL;
+    this->clock = Clock::Wall();
+    this->params.mode = SEARCH_EXHAUSTIVE;
+    this->params.beamWidth = 8;
+    this->params.mctsIterations = 1000;
+    this->params.durationPerturbStd = 0.1;
+    this->params.horizon = SEARCH_STEP;
+    this->params.depth = EXTRA_SEARCH_STEP;
+    this->params.minDepth = EXTRA_SEARCH_STEP;
+    this->params.queueLenPerStep = 0;
+    this->params.timeBudgetMs = 0;
+    this->params.packing = PACK_GREEDY;
+    this->params.exactPackStates = 100000;
+    Load(racks, pendingJobList, runningJobList, isSoft);
+}
+
+/** @brief Constructor. Create a snapshot of another cluster in the middle of a
+ *         search, with the jobs it has started so far in the running jobs.
+ *         The copy is used by another thread, so its jobs are on its own arena.
+ *  @param cluster The cluster to copy
+ */
+Cluster::Cluster(Cluster* cluster) 
+            : arena(&ownArena),
+              pendingJobList(ArenaAllocator<MyJob*>(&ownArena)), 
+              startedJobList(ArenaAllocator<MyJob*>(&ownArena)),
+              placementCache(PLACEMENT_CACHE_SIZE) {
+    this->topology = cluster->topology;
+    this->maxMachinesPerRack = cluster->maxMachinesPerRack;
+    this->pool = NULL;
+    Load(cluster);
+}
+
+/** @brief Destructor, delete the copies of the branches. The jobs are freed by Clear. */
+Cluster::~Cluster() {
+    for (unsigned int i = 0; i < branches.size(); i++)
+        delete branches[i].cluster;
+}
 
+/** @brief Take a new snapshot of the scheduler into a cleared cluster. The 
+ *         memory of the last snapshot is reused, the topology, arena and settings 
+ *         are kept.
+ *  @param racks The vector of Machines of every rack
+ *  @param pendingjoblist The list contains all pending jobs
+ *  @param runningjoblist The heap contains all running jobs
+ *  @param isSoft true if the policy is soft, else false
+ */
+void Cluster::Load(std::vector<std::vector<MyMachine> > & racks, 
+            const std::list<MyJob*> & pendingJobList,
+            const RunningHeap & runningJobList, bool isSoft) {
     this->racks = racks;
+    InitFreeMachines();
+    this->stateHash = 0;
+    this->frameDepth = 0;
     
     // Copy the pending jobs to the cluster.
-    for (std::list<MyJob*>::iterator i=pendingJobList.begin(); 
+    for (std::list<MyJob*>::const_iterator i=pendingJobList.begin(); 
                                              i != pendingJobList.end(); ++i) {
-        MyJob* newJob = new MyJob(*i);
+        MyJob* newJob = CopyJob(*i);
         this->pendingJobList.push_back(newJob);
+        stateHash ^= TranspositionTable::HashKey(HASH_PENDING, newJob->jobId, 0);
     }
     
     // Copy the running jobs to the Cluster.
-    std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> tmp = runningJobList;
-    while(!tmp.empty()) {
-        MyJob* tmpJob = tmp.top();
-        tmp.pop();
-
-        MyJob* newJob = new MyJob(tmpJob);
-        this->runningJobList.push(newJob);
-        for (std::set<int32_t>::iterator it=tmpJob->assignedMachines.begin(); 
-                                    it!=tmpJob->assignedMachines.end(); ++it) {
-            GetMachineByID(*it)->AssignJob(newJob);
+    jobBuffer.clear();
+    for (std::vector<MyJob*>::const_iterator i=runningJobList.GetJobs().begin(); 
+                                             i != runningJobList.GetJobs().end(); ++i) {
+        MyJob* newJob = CopyJob(*i);
+        jobBuffer.push_back(newJob);
+        stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, newJob->jobId, 
+                                                            newJob->GetFinishedTime());
+        for (MachineSet::const_iterator it=newJob->assignedMachines.begin(); 
+                                    it!=newJob->assignedMachines.end(); ++it) {
+            AssignMachine(*it, newJob);
         }
     }
+    this->runningJobList.Build(jobBuffer);
+    this->pendingTable.Build(this->pendingJobList);
 
-    this->maxMachinesPerRack = maxMachinesPerRack;
     this->isSoft = isSoft;
+
+    this->totalMachines = 0;
+    for (unsigned int i = 0; i < this->racks.size(); i++)
+        this->totalMachines += this->racks[i].size();
+    this->stats.expandedNodes = 0;
+    this->stats.prunedBranches = 0;
+    this->stats.completedDepth = 0;
+    this->stats.timedOut = false;
+    this->stats.placementHits = 0;
+    this->stats.placementMisses = 0;
+    this->stats.exactPacks = 0;
+    this->stats.exactPackFallbacks = 0;
+    this->hasDeadline = false;
+    this->mctsMaxValue = 0;
 }
 
-/** @brief Free resources of the cluster object. */
+/** @brief Take a snapshot of another cluster in the middle of a search into a 
+ *         cleared copy, as Cluster(Cluster*) does, reusing the memory of the copy.
+ *  @param cluster The cluster to copy
+ */
+void Cluster::Load(Cluster* cluster) {
+    this->racks = cluster->racks;
+    this->freeBitmaps = cluster->freeBitmaps;
+    this->freeCounts = cluster->freeCounts;
+    this->freeMachineNum = cluster->freeMachineNum;
+    this->rackBuckets = cluster->rackBuckets;
+    this->bucketSizes = cluster->bucketSizes;
+    this->freeCountHash = cluster->freeCountHash;
+    this->freeCountKeys = cluster->freeCountKeys;
+    this->stateHash = 0;
+    this->table = cluster->table;
+    this->clock = cluster->clock;
+    this->frameDepth = 0;
+
+    for (JobList::iterator i=cluster->pendingJobList.begin(); 
+                                             i != cluster->pendingJobList.end(); ++i) {
+        MyJob* newJob = CopyJob(*i);
+        this->pendingJobList.push_back(newJob);
+        stateHash ^= TranspositionTable::HashKey(HASH_PENDING, newJob->jobId, 0);
+    }
+
+    // The heap order only depends on the jobs, so the copy keeps the same layout.
+    jobBuffer.clear();
+    for (std::vector<MyJob*>::const_iterator i=cluster->runningJobList.GetJobs().begin(); 
+                                             i != cluster->runningJobList.GetJobs().end(); ++i) {
+        MyJob* newJob = CopyJob(*i);
+        jobBuffer.push_back(newJob);
+        stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, newJob->jobId, 
+                                                            newJob->GetFinishedTime());
+        for (MachineSet::const_iterator it=newJob->assignedMachines.begin(); 
+                                    it!=newJob->assignedMachines.end(); ++it) {
+            AssignMachine(*it, newJob);
+        }
+    }
+    this->runningJobList.Build(jobBuffer);
+    this->pendingTable.Build(this->pendingJobList);
+
+    this->isSoft = cluster->isSoft;
+    this->totalMachines = cluster->totalMachines;
+    this->stats.expandedNodes = 0;
+    this->stats.prunedBranches = 0;
+    this->stats.completedDepth = 0;
+    this->stats.timedOut = false;
+    this->stats.placementHits = 0;
+    this->stats.placementMisses = 0;
+    this->stats.exactPacks = 0;
+    this->stats.exactPackFallbacks = 0;
+    this->params = cluster->params;
+    this->hasDeadline = cluster->hasDeadline;
+    this->deadline = cluster->deadline;
+    this->mctsMaxValue = 0;
+}
+
+/** @brief Free resources of the cluster object. A copy made by Cluster(Cluster*)
+ *         also resets its own arena, so the cluster can be loaded again.
+ */
 void Cluster::Clear() {
     // Clear the pending jobs.
-    for (std::list<MyJob*>::iterator i=pendingJobList.begin(); 
+    for (JobList::iterator i=pendingJobList.begin(); 
                                              i != pendingJobList.end(); ++i) {
-        delete (*i);
+        DestroyJob(*i);
     }
     
+    pendingJobList.clear();
+    
     // Clear the running jobs.
-    while(!runningJobList.empty()) {
-        MyJob* tmpJob = runningJobList.top();
-        runningJobList.pop();
-        delete tmpJob;
+    // leave the heap before the jobs are deleted, it writes to them
+    jobBuffer = runningJobList.GetJobs();
+    runningJobList.Clear();
+    for (std::vector<MyJob*>::iterator i=jobBuffer.begin(); 
+                                             i != jobBuffer.end(); ++i) {
+        DestroyJob(*i);
     }
+    jobBuffer.clear();
+
+    if (arena == &ownArena)
+        ownArena.Reset();
+}
+
+/** @brief Copy a job into the arena of the cluster, or the heap if it has none.
+ *  @param job The job to copy
+ *  @return The copy, to be freed by DestroyJob
+ */
+MyJob* Cluster::CopyJob(MyJob* job) {
+    if (arena == NULL)
+        return new MyJob(job);
+    return new (arena->Allocate(sizeof(MyJob), alignof(MyJob))) MyJob(job);
+}
+
+/** @brief Free a job made by CopyJob. The memory in the arena is only given 
+ *         back when the arena is reset.
+ *  @param job The job to free
+ */
+void Cluster::DestroyJob(MyJob* job) {
+    if (arena == NULL)
+        delete job;
+    else
+        job->~MyJob();
+}
+
+/** @brief Use a table to cache the utility of searched states.
+ *  @param table The table, NULL to search without caching
+ */
+void Cluster::SetTranspositionTable(TranspositionTable* table) {
+    this->table = table;
+}
+
+/** @brief Search the first level branches on a thread pool.
+ *  @param pool The pool, NULL to search them one after another
+ */
+void Cluster::SetThreadPool(ThreadPool* pool) {
+    this->pool = pool;
+}
+
+/** @brief Take the time of the decision from a clock, the wall clock by default.
+ *  @param clock The clock, it must outlive the cluster
+ */
+void Cluster::SetClock(const Clock* clock) {
+    this->clock = clock;
+}
+
+/** @brief Set the depth, horizon and time budget of the search. With a time budget
+ *         the search deepens one step at a time and returns the result of the 
+ *         deepest search that finished.
+ *  @param params The search parameters
+ */
+void Cluster::SetSearchParams(const SearchParams & params) {
+    this->params = params;
+}
+
+/** @brief Get the number of search steps for the current pending queue: the full 
+ *         depth for a short queue, one step less for every queueLenPerStep jobs, 
+ *         but not less than minDepth.
+ *  @return the number of search steps
+ */
+int Cluster::GetSearchDepth() {
+    if (params.queueLenPerStep <= 0)
+        return params.depth;
+
+    int depth = params.depth - (int)pendingJobList.size() / params.queueLenPerStep;
+    if (depth < params.minDepth)
+        depth = params.minDepth;
+    if (depth > params.depth)
+        depth = params.depth;
+    return depth < 1 ? 1 : depth;
+}
+
+/** @brief Check the deadline. Once it passed, stats.timedOut stays true.
+ *  @return true if the search has to stop
+ */
+bool Cluster::IsTimeUp() {
+    if (stats.timedOut)
+        return true;
+    if (hasDeadline && std::chrono::steady_clock::now() >= deadline)
+        stats.timedOut = true;
+    return stats.timedOut;
+}
+
+/** @brief Get the counters of the searches done so far */
+SearchStats Cluster::GetStats() {
+    return stats;
 }
 
 /** @brief Get the running decision to acheieve the highest utility using n-step search algorithm.
- *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param plan The future decisions of the best schedule, one per simulated job finish 
+ *              until the search stops, NULL if not needed
+ *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID.
+ *          It is kept by the cluster until the next Schedule.
  */
-std::vector<std::vector<int> > Cluster::Schedule() {
+const std::vector<std::vector<int> > & Cluster::Schedule(std::vector<PlanStep>* plan) {
 
-    int counter = SEARCH_STEP;
-    std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> tmpRunningJobList = runningJobList;
+    int counter = std::min(params.horizon, (int)runningJobList.Size());
     
     // searchEndJobId == -1 means no running job, search should be finished immediately
     int searchEndJobId = -1;
 
     // find the searching end job, this job limits the maximum search steps. It should be the nth running job
     // in the current runningJobList
-    while (counter-- > 0 && !tmpRunningJobList.empty()) {
-        searchEndJobId = (int)tmpRunningJobList.top()->jobId;
-        tmpRunningJobList.pop();
+    if (counter > 0) {
+        jobBuffer = runningJobList.GetJobs();
+        std::nth_element(jobBuffer.begin(), jobBuffer.begin() + (counter - 1), jobBuffer.end(),
+                    [](const MyJob* a, const MyJob* b) { return JobComparison()(b, a); });
+        searchEndJobId = (int)jobBuffer[counter - 1]->jobId;
     }
 
     double resultUtility;
+    time_t curTime = clock->Now();
+    int maxDepth = GetSearchDepth();
+
+    if (params.mode != SEARCH_EXHAUSTIVE) {
+        // the greedy decision is kept if the deadline comes before any complete schedule
+        Search(0, -1, curTime, resultUtility, &decision, plan);
+        if (searchEndJobId == -1)
+            return decision;
+
+        if (params.timeBudgetMs > 0) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(params.timeBudgetMs);
+            hasDeadline = true;
+        }
+        // the MCTS decisions after the first one depend on the sampled durations, so it has no plan
+        std::vector<PlanStep> searchPlan;
+        std::vector<std::vector<int> > searchResult;
+        if (params.mode == SEARCH_BEAM)
+            searchResult = BeamSearch(maxDepth, searchEndJobId, curTime, 
+                                    resultUtility, (plan != NULL) ? &searchPlan : NULL);
+        else
+            searchResult = MctsSearch(maxDepth, searchEndJobId, curTime, resultUtility);
+        hasDeadline = false;
+
+        if (resultUtility >= 0) {
+            decision.swap(searchResult);
+            if (plan != NULL)
+                plan->swap(searchPlan);
+            if (!stats.timedOut)
+                stats.completedDepth = maxDepth;
+        }
+        return decision;
+    }
+
+    // starting searching, with maximum maxDepth steps, searching shoud end when encounter searchEndJobId
+    if (params.timeBudgetMs <= 0) {
+        stats.completedDepth = maxDepth;
+        if (pool != NULL)
+            SearchParallel(maxDepth, searchEndJobId, curTime, resultUtility, decision, plan);
+        else
+            Search(maxDepth, searchEndJobId, curTime, resultUtility, &decision, plan);
+        return decision;
+    }
+
+    // With a time budget, start from the greedy decision, then search one step deeper 
+    // each time, until maxDepth steps or the deadline.
+    Search(0, -1, curTime, resultUtility, &decision, plan);
+    if (searchEndJobId == -1)
+        return decision;
+
+    std::vector<PlanStep> depthPlan;
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(params.timeBudgetMs);
+    hasDeadline = true;
+    for (int depth = 1; depth <= maxDepth; depth++) {
+        std::vector<PlanStep>* searchPlan = (plan != NULL) ? &depthPlan : NULL;
+        if (pool != NULL)
+            SearchParallel(depth, searchEndJobId, curTime, resultUtility, depthDecision, searchPlan);
+        else
+            Search(depth, searchEndJobId, curTime, resultUtility, &depthDecision, searchPlan);
 
-    // starting searching, with maximum EXTRA_SEARCH_STEP steps, searching shoud end when encounter searchEndJobId
-    return Search(EXTRA_SEARCH_STEP, searchEndJobId, time(NULL), resultUtility);
+        // the search stopped in the middle, the result is not complete
+        if (IsTimeUp())
+            break;
+        decision.swap(depthDecision);
+        if (plan != NULL)
+            plan->swap(depthPlan);
+        stats.completedDepth = depth;
+    }
+    hasDeadline = false;
+
+    return decision;
 }
 
 /** @brief Get the machine based on the machine ID.
@@ -94,64 +405,256 @@ std::vector<std::vector<int> > Cluster::Schedule() {
  *  @return the machine correspond to the id
  */
 MyMachine* Cluster::GetMachineByID(unsigned int id) {
-    unsigned int rackID = 0;
-    while (id >= racks[rackID].size()) {
-        id -= racks[rackID].size();
-        rackID++;
+    return &(racks[topology->GetRack(id)][topology->GetSlot(id)]);
+}
+
+/** @brief Build the free bitmaps and free counts from the machines. */
+void Cluster::InitFreeMachines() {
+    // the bitmaps of the last snapshot are reused, the racks do not change
+    freeBitmaps.resize(racks.size());
+    freeCounts.assign(racks.size(), 0);
+    freeMachineNum = 0;
+
+    for (unsigned int i = 0; i < racks.size(); i++) {
+        freeBitmaps[i].assign((racks[i].size() + 63) / 64, 0);
+        for (unsigned int j = 0; j < racks[i].size(); j++) {
+            if (racks[i][j].IsFree()) {
+                freeBitmaps[i][j / 64] |= (uint64_t)1 << (j % 64);
+                freeCounts[i]++;
+                freeMachineNum++;
+            }
+        }
+    }
+
+    int rackWords = (racks.size() + 63) / 64;
+    rackBuckets.resize(topology->GetMaxMachinesPerRack() + 1);
+    for (unsigned int c = 0; c < rackBuckets.size(); c++)
+        rackBuckets[c].assign(rackWords, 0);
+    bucketSizes.assign(topology->GetMaxMachinesPerRack() + 1, 0);
+    for (unsigned int i = 0; i < racks.size(); i++) {
+        rackBuckets[freeCounts[i]][i / 64] |= (uint64_t)1 << (i % 64);
+        bucketSizes[freeCounts[i]]++;
+    }
+
+    // the keys are looked up on every machine change, compute them once
+    int countNum = topology->GetMaxMachinesPerRack() + 1;
+    freeCountKeys.resize(racks.size() * countNum);
+    freeCountHash = 0;
+    for (unsigned int i = 0; i < racks.size(); i++) {
+        for (int c = 0; c < countNum; c++)
+            freeCountKeys[i * countNum + c] = TranspositionTable::HashKey(HASH_FREE_COUNT, i, c);
+        freeCountHash ^= freeCountKeys[i * countNum + freeCounts[i]];
+    }
+}
+
+/** @brief Move a rack to another free count bucket.
+ *  @param rack the rack index
+ *  @param from the bucket of the rack
+ *  @param to the new bucket of the rack
+ */
+void Cluster::MoveRackBucket(int rack, int from, int to) {
+    uint64_t bit = (uint64_t)1 << (rack % 64);
+    rackBuckets[from][rack / 64] &= ~bit;
+    bucketSizes[from]--;
+    rackBuckets[to][rack / 64] |= bit;
+    bucketSizes[to]++;
+}
+
+/** @brief Assign a machine to a job.
+ *  @param id the machine id
+ *  @param job the job that gets the machine
+ */
+void Cluster::AssignMachine(int id, MyJob* job) {
+    int rack = topology->GetRack(id), slot = topology->GetSlot(id);
+    racks[rack][slot].AssignJob(job);
+    stateHash ^= TranspositionTable::HashKey(HASH_MACHINE, id, job->jobId);
+
+    // the copies reassign machines that are already taken to their own jobs
+    uint64_t bit = (uint64_t)1 << (slot % 64);
+    if (freeBitmaps[rack][slot / 64] & bit) {
+        freeBitmaps[rack][slot / 64] &= ~bit;
+        freeCounts[rack]--;
+        freeMachineNum--;
+        MoveRackBucket(rack, freeCounts[rack] + 1, freeCounts[rack]);
+        uint64_t* keys = &freeCountKeys[rack * (maxMachinesPerRack + 1) + freeCounts[rack]];
+        freeCountHash ^= keys[0] ^ keys[1];
     }
-    return &(racks[rackID][id]);
+}
+
+/** @brief Free a machine.
+ *  @param id the machine id
+ */
+void Cluster::FreeMachine(int id) {
+    int rack = topology->GetRack(id), slot = topology->GetSlot(id);
+    MyMachine* machine = &racks[rack][slot];
+    stateHash ^= TranspositionTable::HashKey(HASH_MACHINE, id, machine->belongedJob->jobId);
+    machine->Free();
+
+    freeBitmaps[rack][slot / 64] |= (uint64_t)1 << (slot % 64);
+    freeCounts[rack]++;
+    freeMachineNum++;
+    MoveRackBucket(rack, freeCounts[rack] - 1, freeCounts[rack]);
+    uint64_t* keys = &freeCountKeys[rack * (maxMachinesPerRack + 1) + freeCounts[rack] - 1];
+    freeCountHash ^= keys[0] ^ keys[1];
 }
 
 /** @brief Get the total number of free machines */
 int Cluster::GetFreeMachinesNum() {
-    int count = 0;
-    for (unsigned int i = 0; i < racks.size(); i++)
-        for (unsigned int j = 0; j < racks[i].size(); j++)
-            if (racks[i][j].IsFree())
-                count++;
-    return count;
+    return freeMachineNum;
 }
 
 /** @brief Mark a set of machines as allocated
  *  @param machines The set of machines that will be marked as allocated
+ *  @param startTime The simulated time the job starts
  */
-void Cluster::AllocateMachinesToJob(MyJob* job, std::set<int32_t> & machines, bool isPrefered) {
-    for (std::set<int32_t>::iterator it=machines.begin(); 
+void Cluster::AllocateMachinesToJob(MyJob* job, const MachineSet & machines, bool isPrefered, 
+                                                                    time_t startTime) {
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::ALLOCATE;
+    op.job = job;
+    op.startTime = job->startTime;
+    op.finishTime = job->finishTime;
+    op.isPrefered = job->isPrefered;
+    undoLog.push_back(op);
+
+    for (MachineSet::const_iterator it=machines.begin(); 
                                                 it!=machines.end(); ++it) {
-        GetMachineByID(*it)->AssignJob(job);
+        AssignMachine(*it, job);
     }
 
-    job->Start(machines, isPrefered);
+    job->Start(machines, isPrefered, startTime);
 }
 
 /** @brief Free machines belong to the job
  *  @param job the freed job
  */
 void Cluster::FreeMachinesByJob(MyJob* job) {
-    std::set<int32_t> tmpMachines = job->assignedMachines;
-
-    for (std::set<int32_t>::iterator it=tmpMachines.begin(); 
-                                    it!=tmpMachines.end(); ++it) {
-        GetMachineByID(*it)->Free();
-        job->assignedMachines.erase(*it);
+    for (MachineSet::const_iterator it=job->assignedMachines.begin(); 
+                                    it!=job->assignedMachines.end(); ++it) {
+        FreeMachine(*it);
     }
+
+    // Keep the freed machines in the log, so that they can be given back
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::FREE;
+    op.job = job;
+    undoLog.push_back(op);
+    undoLog.back().machines.Swap(job->assignedMachines);
 }
 
-/** @brief Get free VM number of every rack
- *  @return free VM number of every rack
+/** @brief Add a job to the running jobs.
+ *  @param job the started job
  */
-std::vector<int> Cluster::GetFreeMachines() {
-    std::vector<int> freeMachines; 
-    for (unsigned int i = 0; i < racks.size(); i++) {
-        int num = 0;
-        for (unsigned int j = 0; j < racks[i].size(); j++) {
-            if (racks[i][j].IsFree()) {
-                num++;
-            }
+void Cluster::PushRunningJob(MyJob* job) {
+    runningJobList.Push(job);
+    stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, job->jobId, job->GetFinishedTime());
+
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::PUSH_RUNNING;
+    op.job = job;
+    undoLog.push_back(op);
+}
+
+/** @brief Remove the running job that finishes first.
+ *  @return the removed job
+ */
+MyJob* Cluster::PopRunningJob() {
+    MyJob* job = runningJobList.Pop();
+    stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, job->jobId, job->GetFinishedTime());
+
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::POP_RUNNING;
+    op.job = job;
+    undoLog.push_back(op);
+    return job;
+}
+
+/** @brief Take a job out of the pending jobs, its machines are allocated by the caller.
+ *  @param jobIter the position of the job in pendingJobList
+ */
+void Cluster::StartPendingJob(JobList::iterator jobIter) {
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::START_PENDING;
+    op.job = *jobIter;
+    op.node = jobIter;
+    op.next = jobIter;
+    ++op.next;
+    undoLog.push_back(op);
+
+    // splice keeps the list node, so the positions in the log stay valid
+    startedJobList.splice(startedJobList.end(), pendingJobList, jobIter);
+    pendingTable.SetPending(op.job, false);
+    stateHash ^= TranspositionTable::HashKey(HASH_PENDING, op.job->jobId, 0);
+}
+
+/** @brief Put the latest started job back to the end of the pending jobs,
+ *         its machines are freed by the caller.
+ */
+void Cluster::DelayLastStartedJob() {
+    JobList::iterator jobIter = startedJobList.end();
+    --jobIter;
+
+    SearchOp op = SearchOp();
+    op.kind = SearchOp::DELAY_PENDING;
+    op.job = *jobIter;
+    op.node = jobIter;
+    undoLog.push_back(op);
+
+    pendingJobList.splice(pendingJobList.end(), startedJobList, jobIter);
+    pendingTable.SetPending(op.job, true);
+    stateHash ^= TranspositionTable::HashKey(HASH_PENDING, op.job->jobId, 0);
+}
+
+/** @brief Undo the changes in the log until only checkpoint entries are left.
+ *  @param checkpoint The size of the undo log to go back to
+ */
+void Cluster::Rollback(size_t checkpoint) {
+    while (undoLog.size() > checkpoint) {
+        SearchOp & op = undoLog.back();
+        MyJob* job = op.job;
+
+        switch (op.kind) {
+            case SearchOp::ALLOCATE:
+                for (MachineSet::const_iterator it=job->assignedMachines.begin(); 
+                                                it!=job->assignedMachines.end(); ++it) {
+                    FreeMachine(*it);
+                }
+                job->assignedMachines.Clear();
+                job->startTime = op.startTime;
+                job->isPrefered = op.isPrefered;
+                job->finishTime = op.finishTime;
+                break;
+            case SearchOp::FREE:
+                job->assignedMachines.Swap(op.machines);
+                for (MachineSet::const_iterator it=job->assignedMachines.begin(); 
+                                                it!=job->assignedMachines.end(); ++it) {
+                    AssignMachine(*it, job);
+                }
+                break;
+            case SearchOp::POP_RUNNING:
+                runningJobList.Push(job);
+                stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, job->jobId, 
+                                                                job->GetFinishedTime());
+                break;
+            case SearchOp::PUSH_RUNNING:
+                // the job is not always on the top, remove it from where it is
+                runningJobList.Erase(job);
+                stateHash ^= TranspositionTable::HashKey(HASH_RUNNING, job->jobId, 
+                                                                job->GetFinishedTime());
+                break;
+            case SearchOp::START_PENDING:
+                pendingJobList.splice(op.next, startedJobList, op.node);
+                pendingTable.SetPending(job, true);
+                stateHash ^= TranspositionTable::HashKey(HASH_PENDING, job->jobId, 0);
+                break;
+            case SearchOp::DELAY_PENDING:
+                startedJobList.splice(startedJobList.end(), pendingJobList, op.node);
+                pendingTable.SetPending(job, false);
+                stateHash ^= TranspositionTable::HashKey(HASH_PENDING, job->jobId, 0);
+                break;
         }
-        freeMachines.push_back(num);
+        undoLog.pop_back();
     }
-    return freeMachines;
 }
 
 /** @brief Get k free VMs from rack index
@@ -159,10 +662,14 @@ std::vector<int> Cluster::GetFreeMachines() {
  *  @param k The number of machines that the is asking
  *  @param index The rack to get k VMs
  */
-void Cluster::GetMachineByRack(std::set<int> & machines, int k, int index) {
-    for (unsigned int i = 0; k != 0 && i < racks[index].size(); i++) {
-        if (racks[index][i].IsFree()) {
-            machines.insert(racks[index][i].machineID);
+void Cluster::GetMachineByRack(MachineSet & machines, int k, int index) {
+    // the lowest free slots first
+    for (unsigned int i = 0; k != 0 && i < freeBitmaps[index].size(); i++) {
+        uint64_t word = freeBitmaps[index][i];
+        while (k != 0 && word != 0) {
+            int slot = i * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            machines.Insert(racks[index][slot].machineID);
             k--;
         }
     }
@@ -172,21 +679,65 @@ void Cluster::GetMachineByRack(std::set<int> & machines, int k, int index) {
 }
 
 
-/** @brief Get the rack number which has minimum free VMs
- *  @param freemachines the free VM number of every rack
- *  @return the index of the rack
+/** @brief Get the rack which has minimum free VMs, on a tie the last one
+ *  @return the index of the rack, -1 if every rack is full
  */
-int Cluster::FindMinRack(std::vector<int> & freeMachines) {
-    int min = maxMachinesPerRack;
-    int index = -1;
-    for (unsigned int i = 0; i < freeMachines.size(); i++) {
-        int num = freeMachines[i];
-        if (num != 0 && num <= min) {
-            min = num;
-            index = i;
+int Cluster::FindMinRack() {
+    for (int c = 1; c <= maxMachinesPerRack; c++) {
+        if (bucketSizes[c] == 0)
+            continue;
+        for (int i = rackBuckets[c].size() - 1; i >= 0; i--) {
+            if (rackBuckets[c][i] != 0)
+                return i * 64 + 63 - __builtin_clzll(rackBuckets[c][i]);
         }
     }
-    return index;
+    return -1;
+}
+
+/** @brief Get the rack other than the GPU rack which has the fewest free VMs,
+ *         but at least k, on a tie the first one
+ *  @param k The number of VMs
+ *  @return the index of the rack, -1 if no such rack
+ */
+int Cluster::FindBestFitRack(int k) {
+    for (int c = std::max(k, 0); c <= maxMachinesPerRack; c++) {
+        if (bucketSizes[c] == 0)
+            continue;
+        for (unsigned int i = 0; i < rackBuckets[c].size(); i++) {
+            uint64_t word = rackBuckets[c][i];
+            if (i == 0)
+                word &= ~(uint64_t)1;
+            if (word != 0)
+                return i * 64 + __builtin_ctzll(word);
+        }
+    }
+    return -1;
+}
+
+/** @brief Get k VMs from the racks with the fewest free VMs, 
+ *         when no rack has enough VMs for the job
+ *  @param machines The set of machines to store k free VMs
+ *  @param k The number of machines that the job is asking 
+ */
+void Cluster::GetMachinesFromMinRacks(MachineSet & machines, int k) {
+    // the emptied racks leave the buckets until the machines are picked
+    emptiedRacks.clear();
+    while (k != 0) {
+        int index = FindMinRack();
+        if (freeCounts[index] <= k) {
+            GetMachineByRack(machines, freeCounts[index], index);
+            k -= freeCounts[index];
+            MoveRackBucket(index, freeCounts[index], 0);
+            emptiedRacks.push_back(index);
+        }
+        else {
+            GetMachineByRack(machines, k, index);
+            k = 0;
+        }
+    }
+
+    for (unsigned int i = 0; i < emptiedRacks.size(); i++)
+        MoveRackBucket(emptiedRacks[i], 0, freeCounts[emptiedRacks[i]]);
 }
 
 /** @brief Get (preferred configuration) machines for MPI job.
@@ -194,20 +745,8 @@ int Cluster::FindMinRack(std::vector<int> & freeMachines) {
  *  @param k The number of machines that the job is asking 
  *  @return true if on job's preferred allocation, else false
  */
-bool Cluster::GetMachinesForMPI(std::set<int> & machines, int k) {
-    std::vector<int> freeMachines = GetFreeMachines();
-    
-    int min = maxMachinesPerRack + 1;
-    int index = -1;
-    for (unsigned int i = 1; i < freeMachines.size(); i++) {
-        int num = freeMachines[i];
-        if (num >= k) {
-            if (num < min) {
-                min = num;
-                index = i;
-            }
-        }        
-    }
+bool Cluster::GetMachinesForMPI(MachineSet & machines, int k) {
+    int index = FindBestFitRack(k);
 
     /* When one rack(no GPU) has enough VMs for MPI jobs */
     if (index != -1) {
@@ -216,23 +755,12 @@ bool Cluster::GetMachinesForMPI(std::set<int> & machines, int k) {
     }
     
     /* When GPU rack has enough VMs for MPI jobs */
-    if (freeMachines[0] >= k) {
+    if (freeCounts[0] >= k) {
         GetMachineByRack(machines, k, 0);
         return true;
     }
     
-    while (k != 0) {
-        index = FindMinRack(freeMachines);
-        if (freeMachines[index] <= k) {
-            GetMachineByRack(machines, freeMachines[index], index);
-            k -= freeMachines[index];
-            freeMachines[index] = 0;
-        }
-        else {
-            GetMachineByRack(machines, k, index);
-            k = 0;
-        }
-    }
+    GetMachinesFromMinRacks(machines, k);
     return false;
 }
 
@@ -241,165 +769,480 @@ bool Cluster::GetMachinesForMPI(std::set<int> & machines, int k) {
  *  @param k The number of machines that the job is asking 
  *  @return true if on job's preferred allocation, else false
  */
-bool Cluster::GetMachinesForGPU(std::set<int> & machines, int k) {
-    std::vector<int> freeMachines = GetFreeMachines();
-     
+bool Cluster::GetMachinesForGPU(MachineSet & machines, int k) {
     /* When the GPU rack has enough VMs for GPU jobs */
-    if (freeMachines[0] >= k) {
+    if (freeCounts[0] >= k) {
         GetMachineByRack(machines, k, 0);
         return true;
     }
     
-    int index;
-    while (k != 0) {
-        index = FindMinRack(freeMachines);
-        if (freeMachines[index] <= k) {
-            GetMachineByRack(machines, freeMachines[index], index);
-            k -= freeMachines[index];
-            freeMachines[index] = 0;
-        }
-        else {
-            GetMachineByRack(machines, k, index);
-            k = 0;
-        }
-    }
+    GetMachinesFromMinRacks(machines, k);
     return false;
 } 
 
-/** @brief Get machines for specific job.
+/** @brief Get machines for specific job. The racks of a placement are cached by 
+ *         the free count of every rack, the machines are picked from them again.
  *  @param machines The set of machines that will be allocated to the job 
  *  @param jobType The type of the job
  *  @param k The number of machines that the job is asking 
  *  @return true if on job's preferred allocation, else false
  */
 bool Cluster::GetBestMachines(job_t::type jobType, int k, 
-                                            std::set<int32_t> &machines) {
+                                            MachineSet &machines) {
+    uint64_t key = freeCountHash ^ TranspositionTable::HashKey(HASH_PLACEMENT, jobType, k);
+    const PlacementCache::Entry* entry = placementCache.Probe(key);
+
+    // the racks of a colliding key are only used if they still have the machines
+    bool fits = (entry != NULL);
+    for (int i = 0; fits && i < entry->rackNum; i++)
+        fits = (freeCounts[entry->racks[i]] >= entry->counts[i]);
+    if (fits) {
+        stats.placementHits++;
+        for (int i = 0; i < entry->rackNum; i++)
+            GetMachineByRack(machines, entry->counts[i], entry->racks[i]);
+        return entry->isPrefered;
+    }
+    stats.placementMisses++;
+
+    bool isPrefered;
     switch(jobType) {
         case job_t::JOB_MPI:
-            return GetMachinesForMPI(machines, k);
+            isPrefered = GetMachinesForMPI(machines, k);
+            break;
         case job_t::JOB_GPU:   
-            return GetMachinesForGPU(machines, k);
+            isPrefered = GetMachinesForGPU(machines, k);
+            break;
         default:{
             dbg_printf("Unknown job type:%d\n", jobType);
             return false;
         }
     } 
+
+    // Every rack gives its lowest free slots, so the racks and counts are enough 
+    // to pick the same machines again. The ids of a rack are next to each other.
+    PlacementCache::Entry newEntry;
+    newEntry.key = key;
+    newEntry.isPrefered = isPrefered;
+    newEntry.rackNum = 0;
+    for (MachineSet::const_iterator it=machines.begin(); it!=machines.end(); ++it) {
+        int rack = topology->GetRack(*it);
+        if (newEntry.rackNum > 0 && newEntry.racks[newEntry.rackNum - 1] == rack) {
+            newEntry.counts[newEntry.rackNum - 1]++;
+            continue;
+        }
+        if (newEntry.rackNum == PlacementCache::MAX_RACKS)
+            return isPrefered;
+        newEntry.racks[newEntry.rackNum] = rack;
+        newEntry.counts[newEntry.rackNum] = 1;
+        newEntry.rackNum++;
+    }
+    placementCache.Store(newEntry);
+    return isPrefered;
+}
+
+/** @brief Get an upper bound of the utility that the pending jobs can still give,
+ *         if none of them starts before curTime. Utility only goes down with time.
+ *  @param curTime The earliest time a pending job can start
+ *  @param capacity The number of machines the jobs are started on all at once,
+ *                  -1 if they may start at different times
+ *  @return the upper bound
+ */
+double Cluster::UtilityUpperBound(time_t curTime, int capacity) {
+    if (capacity < 0) {
+        double bound = 0;
+        for (JobList::iterator i=pendingJobList.begin(); 
+                                                    i != pendingJobList.end(); ++i) {
+            if ((*i)->k <= totalMachines)
+                bound += std::max((*i)->CalUtility(curTime, true), (*i)->CalUtility(curTime, false));
+        }
+        return bound;
+    }
+
+    // Fractional knapsack: fill the capacity with the highest utility per machine first.
+    std::vector<std::pair<double, std::pair<double, int> > > & jobs = boundJobs;
+    jobs.clear();
+    for (JobList::iterator i=pendingJobList.begin(); 
+                                                i != pendingJobList.end(); ++i) {
+        if ((*i)->k <= capacity) {
+            double utility = std::max((*i)->CalUtility(curTime, true), (*i)->CalUtility(curTime, false));
+            jobs.push_back(std::make_pair(utility / (*i)->k, std::make_pair(utility, (*i)->k)));
+        }
+    }
+    std::sort(jobs.begin(), jobs.end());
+
+    double bound = 0;
+    for (std::vector<std::pair<double, std::pair<double, int> > >::reverse_iterator it = jobs.rbegin(); 
+                                                capacity > 0 && it != jobs.rend(); ++it) {
+        int k = it->second.second;
+        if (k <= capacity) {
+            bound += it->second.first;
+            capacity -= k;
+        } else {
+            bound += it->first * capacity;
+            capacity = 0;
+        }
+    }
+    return bound;
+}
+
+/** @brief Find the machines of a shape on the current free machines.
+ *  @param shape The shape of the pending table
+ *  @return true if the machines are preferred
+ */
+bool Cluster::PlaceShape(int shape) {
+    // try to find the best (preferred) machine allocation, for hard policy 
+    // the jobs remain pending if preference can not be satisfied
+    shapeMachines[shape].Clear();
+    int k = pendingTable.GetShapeK(shape);
+    bool isPrefered = GetBestMachines(pendingTable.GetShapeType(shape), k, 
+                                                            shapeMachines[shape]);
+    // a job type without a placement gets no machines, its jobs remain pending
+    if ((int)shapeMachines[shape].Size() < k) {
+        shapePlacements[shape] = -2;
+        return false;
+    }
+    shapePlacements[shape] = isPrefered ? 1 : 0;
+    return isPrefered;
+}
+
+/** @brief Start as many pending jobs as the free machines allow, picking the job 
+ *         with the highest utility each time. Equal utilities go to the smaller 
+ *         job id, so the order of pendingJobList does not matter. Every shape that 
+ *         fits offers its pending job with the highest utility from the shape 
+ *         orders of the pending table, the best utility it may get until the shape
+ *         is placed, then the utility on its machines. A shape that does not fit 
+ *         any more is not looked at again. The changes are left in the undo log.
+ *  @param curTime "Current" time of simulation, no job arrives after it
+ *  @param potentialRunningJobs The started jobs, in the order they are picked
+ *  @param potentialUtility The utility of each started job
+ */
+void Cluster::GreedyStart(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                            std::vector<double> & potentialUtility) {
+    int shapeNum = pendingTable.GetShapeNum();
+    if ((int)shapeMachines.size() < shapeNum)
+        shapeMachines.resize(shapeNum);
+    pendingTable.ResetHeads();
+
+    while (true) {
+        int freeMachineNum = GetFreeMachinesNum();
+        shapePlacements.assign(shapeNum, -1);
+        int bestRow, bestShape;
+        double maxUtility;
+        while (true) {
+            bestRow = -1;
+            bestShape = -1;
+            maxUtility = 0;
+            for (int shape = 0; shape < shapeNum; shape++) {
+                if (pendingTable.GetShapeK(shape) > freeMachineNum)
+                    continue;
+
+                PendingTable::Order order;
+                if (shapePlacements[shape] == -2)
+                    continue;
+                else if (shapePlacements[shape] == -1)
+                    order = isSoft ? PendingTable::ORDER_BEST : PendingTable::ORDER_PREFERED;
+                else if (shapePlacements[shape] == 1)
+                    order = PendingTable::ORDER_PREFERED;
+                else if (isSoft)
+                    order = PendingTable::ORDER_SLOW;
+                else
+                    continue;
+
+                double utility;
+                int row = pendingTable.GetHead(shape, order, curTime, utility);
+                if (row == -1 || utility <= 0)
+                    continue;
+                if (utility > maxUtility || (utility == maxUtility && row < bestRow)) {
+                    bestRow = row;
+                    bestShape = shape;
+                    maxUtility = utility;
+                }
+            }
+            if (bestShape == -1 || shapePlacements[bestShape] != -1)
+                break;
+            PlaceShape(bestShape);
+        }
+
+        if (bestShape == -1)
+            // not job can be satisfied with current left resource
+            break;
+
+        JobList::iterator bestJobIter = pendingTable.GetNode(bestRow);
+        MyJob* bestJob = *bestJobIter;
+        StartPendingJob(bestJobIter);
+        AllocateMachinesToJob(bestJob, shapeMachines[bestShape], shapePlacements[bestShape] == 1, curTime);
+        potentialRunningJobs.push_back(bestJob);
+        potentialUtility.push_back(maxUtility);
+    }
+}
+
+/** @brief Start the pending jobs with the highest total utility on the free machines,
+ *         found by the exact packer. Of the jobs of one shape at most 
+ *         free / k start, and they can be swapped for the ones of the shape with 
+ *         the highest utility, so only those are packed. The changes are left in 
+ *         the undo log.
+ *  @param curTime "Current" time of simulation
+ *  @param potentialRunningJobs The started jobs, the highest utility first
+ *  @param potentialUtility The utility of each started job
+ *  @return false if the packer gave up, then nothing is started
+ */
+bool Cluster::ExactStart(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                            std::vector<double> & potentialUtility) {
+    int freeMachineNum = GetFreeMachinesNum();
+    std::vector<std::vector<MyJob*> > shapeJobs(pendingTable.GetShapeNum());
+    for (JobList::iterator i=pendingJobList.begin(); i != pendingJobList.end(); ++i) {
+        // the packer only places MPI and GPU jobs, the others remain pending
+        if ((*i)->jobType != job_t::JOB_MPI && (*i)->jobType != job_t::JOB_GPU)
+            continue;
+        if ((*i)->k <= freeMachineNum)
+            shapeJobs[pendingTable.GetShape((*i)->pendingIndex)].push_back(*i);
+    }
+
+    std::vector<MyJob*> jobs;
+    for (unsigned int shape = 0; shape < shapeJobs.size(); shape++) {
+        std::vector<MyJob*> & candidates = shapeJobs[shape];
+        if (candidates.empty())
+            continue;
+        unsigned int num = std::min((size_t)(freeMachineNum / candidates[0]->k), candidates.size());
+        for (int slow = 0; slow < (isSoft ? 2 : 1); slow++) {
+            bool isPrefered = (slow == 0);
+            std::partial_sort(candidates.begin(), candidates.begin() + num, candidates.end(),
+                    [curTime, isPrefered](MyJob* a, MyJob* b) {
+                        double utilityA = a->CalUtility(curTime, isPrefered);
+                        double utilityB = b->CalUtility(curTime, isPrefered);
+                        if (utilityA != utilityB)
+                            return utilityA > utilityB;
+                        return a->jobId < b->jobId;
+                    });
+            jobs.insert(jobs.end(), candidates.begin(), candidates.begin() + num);
+        }
+    }
+    std::sort(jobs.begin(), jobs.end(), [](MyJob* a, MyJob* b) { return a->jobId < b->jobId; });
+    jobs.erase(std::unique(jobs.begin(), jobs.end()), jobs.end());
+
+    std::vector<ExactPacker::Item> items(jobs.size());
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        items[i].jobType = jobs[i]->jobType;
+        items[i].k = jobs[i]->k;
+        items[i].preferedUtility = jobs[i]->CalUtility(curTime, true);
+        items[i].slowUtility = jobs[i]->CalUtility(curTime, false);
+    }
+
+    std::vector<int> choices;
+    if (!exactPacker.Pack(freeCounts, items, isSoft, params.exactPackStates, choices)) {
+        stats.exactPackFallbacks++;
+        return false;
+    }
+    stats.exactPacks++;
+
+    // Pick the machines of the preferred jobs from their racks first, then any free
+    // machines for the others. The jobs are started again the highest utility 
+    // first, so the search delays the lowest ones first.
+    size_t checkpoint = undoLog.size();
+    std::vector<MachineSet> machines(jobs.size());
+    std::vector<int> started;
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < jobs.size(); i++) {
+            if (choices[i] == ExactPacker::PACK_SKIP || (choices[i] == ExactPacker::PACK_ANY) != (pass == 1))
+                continue;
+            if (pass == 0)
+                GetMachineByRack(machines[i], jobs[i]->k, choices[i]);
+            else
+                GetMachinesFromMinRacks(machines[i], jobs[i]->k);
+            AllocateMachinesToJob(jobs[i], machines[i], pass == 0, curTime);
+            started.push_back(i);
+        }
+    }
+    Rollback(checkpoint);
+
+    std::sort(started.begin(), started.end(), [&items, &choices](int a, int b) {
+                double utilityA = (choices[a] == ExactPacker::PACK_ANY) ? items[a].slowUtility : items[a].preferedUtility;
+                double utilityB = (choices[b] == ExactPacker::PACK_ANY) ? items[b].slowUtility : items[b].preferedUtility;
+                if (utilityA != utilityB)
+                    return utilityA > utilityB;
+                return a < b;
+            });
+    for (unsigned int i = 0; i < started.size(); i++) {
+        int index = started[i];
+        bool isPrefered = (choices[index] != ExactPacker::PACK_ANY);
+        StartPendingJob(pendingTable.GetNode(jobs[index]->pendingIndex));
+        AllocateMachinesToJob(jobs[index], machines[index], isPrefered, curTime);
+        potentialRunningJobs.push_back(jobs[index]);
+        potentialUtility.push_back(isPrefered ? items[index].preferedUtility : items[index].slowUtility);
+    }
+    return true;
+}
+
+/** @brief Start the pending jobs of a search decision by the packing policy, 
+ *         greedy if the exact packer gives up. The changes are left in the undo log.
+ *  @param curTime "Current" time of simulation
+ *  @param potentialRunningJobs The started jobs, the highest utility first
+ *  @param potentialUtility The utility of each started job
+ */
+void Cluster::StartJobs(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                            std::vector<double> & potentialUtility) {
+    if (params.packing == PACK_EXACT && ExactStart(curTime, potentialRunningJobs, potentialUtility))
+        return;
+    GreedyStart(curTime, potentialRunningJobs, potentialUtility);
+}
+
+/** @brief Get an upper bound of the utility of the decisions after a branch, whose
+ *         jobs were just pushed to runningJobList. The next decision is made when 
+ *         the first running job finishes. If that is the last step, the jobs are 
+ *         started all at once on the machines free by then.
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ *  @return the upper bound
+ */
+double Cluster::BranchUpperBound(int step, int searchEndJobId, time_t curTime) {
+    MyJob* nextFinishedJob = runningJobList.Top();
+    time_t nextTime = curTime;
+    if (difftime(nextFinishedJob->GetFinishedTime(), curTime) > 0)
+        nextTime = nextFinishedJob->GetFinishedTime();
+
+    int capacity = -1;
+    if ((int)nextFinishedJob->jobId == searchEndJobId)
+        capacity = GetFreeMachinesNum() + nextFinishedJob->assignedMachines.Size();
+    else if (step == 1)
+        capacity = totalMachines;
+
+    return UtilityUpperBound(nextTime, capacity);
+}
+
+/** @brief Sum the utilities of the jobs of a branch, always in the same order, so
+ *         that every search path gets the same value for the same branch.
+ *  @param utility The utility of each job
+ *  @return the sum
+ */
+double Cluster::SumUtility(const std::vector<double> & utility) {
+    double sum = 0;
+    for (std::vector<double>::const_iterator it = utility.begin(); it != utility.end(); ++it)
+        sum += *it;
+    return sum;
+}
+
+/** @brief Take the buffers of the next search level, the caller gives them back by 
+ *         decreasing frameDepth.
+ *  @return The buffers
+ */
+Cluster::SearchFrame & Cluster::PushFrame() {
+    if (frameDepth == frames.size()) {
+        // a level never starts more jobs than were pending before the search
+        size_t jobNum = pendingJobList.size() + startedJobList.size();
+        frames.push_back(SearchFrame());
+        frames.back().potentialRunningJobs.reserve(jobNum);
+        frames.back().potentialUtility.reserve(jobNum);
+    }
+    return frames[frameDepth++];
 }
 
 /** @brief Search for the running decision to get highest utility.
+ *         All changes to the cluster are undone before returning.
  *  @param step The number of search step
  *  @param searchEndJobId The job which is the end of the search process
  *  @param curTime "Current" time of simulation
  *  @param resultUtility The total utility of each search process, this is also a return value
- *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param result The decision of the best branch, NULL if not needed. For each vector, 
+ *                0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param plan The future decisions of the best branch, NULL if not needed
  */
-std::vector<std::vector<int> > Cluster::Search(int step, int searchEndJobId, time_t curTime, double & resultUtility) {
+void Cluster::Search(int step, int searchEndJobId, time_t curTime, double & resultUtility,
+                    std::vector<std::vector<int> >* result, std::vector<PlanStep>* plan) {
+    if (plan != NULL)
+        plan->clear();
+    if (result != NULL)
+        ResizeResult(*result, 0);
+
+    if (IsTimeUp()) {
+        // the caller drops the whole search, any result will do
+        resultUtility = 0;
+        return;
+    }
+
+    size_t checkpoint = undoLog.size();
+    stats.expandedNodes++;
+
     if (step == 0 && searchEndJobId != -1) {
         // no search step left, can not search decisions, just go to the last search step
-        MyJob* finishedJob = runningJobList.top();
-        runningJobList.pop();
+        MyJob* finishedJob = PopRunningJob();
 
         int nextSearchEndJobId = ((int)finishedJob->jobId == searchEndJobId) ? -1 : searchEndJobId;
         
-        FreeMachinesByJob(finishedJob);
-        
         time_t nextTime = curTime;
         if (difftime(finishedJob->GetFinishedTime(), curTime) > 0)
             nextTime = finishedJob->GetFinishedTime();
 
-        return Search(step, nextSearchEndJobId, nextTime, resultUtility);
+        FreeMachinesByJob(finishedJob);
+
+        // the decisions in between are not searched, so there is no plan
+        Search(step, nextSearchEndJobId, nextTime, resultUtility, result, NULL);
+        Rollback(checkpoint);
+        return;
     }
 
+    // the buffers of this depth, the levels below use the ones after it
+    SearchFrame & frame = PushFrame();
+
     // potentialRunningJobs is used to store the (maximum possible) jobs that can be scheduled with current 
     // resources, the first element in potentialRunningJobs is the job with the highest utiltiy
-    std::vector<MyJob*> potentialRunningJobs;
+    std::vector<MyJob*> & potentialRunningJobs = frame.potentialRunningJobs;
     // potentialUtility stores the utilities gained from each job in potentialRunningJobs
-    std::vector<double> potentialUtility;
-
-
-    // try to schedule as many jobs as possible with current resources, following the utility greedy policy
-    while (true) {
-        std::list<MyJob*>::iterator bestJobIter;
-        double maxUtility = -1, tmpUtility;
-        std::set<int32_t> bestMachines, tmpMachines;
-        bool isBestisPrefered;
-
-        int freeMachineNum = GetFreeMachinesNum();
-
-        for (std::list<MyJob*>::iterator i=pendingJobList.begin(); 
-                                                    i != pendingJobList.end(); ++i){
-            if (freeMachineNum >= (*i)->k) {
-                // try to find the best (preferred) machine allocation
-                bool isPrefered = 
-                        GetBestMachines((*i)->jobType, (*i)->k, tmpMachines);
-
-                if (!isPrefered && !isSoft) {
-                    // for hard policy, job remains pending if preference can not be satisfied
-                    tmpMachines.clear();
-                    continue;
-                }
-                
-                tmpUtility = (*i)->CalUtility(curTime, isPrefered);
-
-                // if find a job with larger utility, update schedule solution
-                if (maxUtility < tmpUtility) {
-                    bestJobIter = i;
-                    maxUtility = tmpUtility;
-                    bestMachines = tmpMachines;
-                    isBestisPrefered = isPrefered;
-                }  
-                tmpMachines.clear();
-            }
-        }
+    std::vector<double> & potentialUtility = frame.potentialUtility;
+    potentialRunningJobs.clear();
+    potentialUtility.clear();
 
-        // find a runnable job with current left resources, add it to potentialRunningJobs
-        if (maxUtility > 0) {
-            AllocateMachinesToJob(*bestJobIter, bestMachines, isBestisPrefered);
-            potentialRunningJobs.push_back(*bestJobIter);
-            pendingJobList.erase(bestJobIter);
-
-            potentialUtility.push_back(maxUtility);
-        } else
-            // not job can be satisfied with current left resource
-            break;
-    }
+    StartJobs(curTime, potentialRunningJobs, potentialUtility);
 
-    std::vector<std::vector<int> > result = constructResult(potentialRunningJobs);
+    if (result != NULL)
+        constructResult(potentialRunningJobs, *result);
     
     // Get the current total utility, which is the total utility if all potentialRunningJobs are really scheduled
-    double curUtility = 0;
-    for (std::vector<double>::iterator it = potentialUtility.begin() ; it != potentialUtility.end(); ++it)
-        curUtility += *it;
+    double curUtility = SumUtility(potentialUtility);
 
     // searchEndJobId == -1, should end search immediately 
     if (searchEndJobId == -1) {
         resultUtility = curUtility;
-        return result;
+        Rollback(checkpoint);
+        frameDepth--;
+        return;
     }
 
 
     // try to delay one or more jobs in potentialRunningJobs (i.e. don't run all jobs even some resources are available)
+    // Every branch starts a prefix of the greedy decision already in result, so only 
+    // the number of jobs the best branch starts is kept.
     resultUtility = -1;
+    size_t resultSize = potentialRunningJobs.size();
     while(true) {
-        
+        size_t branchCheckpoint = undoLog.size();
+
         // add all jobs in potentialRunningJobs to runningJobList
-        std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> tmpRunningJobList = runningJobList;
         for (std::vector<MyJob*>::iterator it=potentialRunningJobs.begin(); 
                                         it != potentialRunningJobs.end(); ++it){
-            tmpRunningJobList.push(*it);
+            PushRunningJob(*it);
         }
 
-        // Based on the current the allocated decision, simulate and schedule the next allocated decision 
-        // and get the total utility.
-        double nextResultUtility;
-        Cluster cluster(racks, pendingJobList, tmpRunningJobList, maxMachinesPerRack, isSoft);
-        cluster.SimulateNext(step, searchEndJobId, curTime, nextResultUtility);
-        cluster.Clear();
+        // Skip the branch if even the upper bound of its utility can not beat the best one. 
+        if (curUtility + BranchUpperBound(step, searchEndJobId, curTime) <= resultUtility) {
+            stats.prunedBranches++;
+            Rollback(branchCheckpoint);
+        } else {
+            // Based on the current the allocated decision, simulate and schedule the next allocated decision 
+            // and get the total utility, then go back to the current decision.
+            double nextResultUtility;
+            std::vector<PlanStep> branchPlan;
+            SimulateNext(step, searchEndJobId, curTime, nextResultUtility, 
+                                                (plan != NULL) ? &branchPlan : NULL);
+            Rollback(branchCheckpoint);
 
-        // Compare the current schedule utility with the last best one.
-        if (curUtility + nextResultUtility > resultUtility) {
-            resultUtility = curUtility + nextResultUtility;
-            result = constructResult(potentialRunningJobs);
+            // Compare the current schedule utility with the last best one.
+            if (curUtility + nextResultUtility > resultUtility) {
+                resultUtility = curUtility + nextResultUtility;
+                resultSize = potentialRunningJobs.size();
+                if (plan != NULL)
+                    plan->swap(branchPlan);
+            }
         }
 
         if (potentialRunningJobs.empty())
@@ -408,62 +1251,651 @@ std::vector<std::vector<int> > Cluster::Search(int step, int searchEndJobId, tim
         // delay the last potential running job (add it back to pendingJobList, free resources)
         MyJob* myjob = potentialRunningJobs.back();
         potentialRunningJobs.pop_back();
-        curUtility -= potentialUtility.back();
         potentialUtility.pop_back();
+        curUtility = SumUtility(potentialUtility);
         
-        pendingJobList.push_back(myjob);
+        DelayLastStartedJob();
+        FreeMachinesByJob(myjob);
+    }
+
+    if (result != NULL)
+        ResizeResult(*result, resultSize);
+    Rollback(checkpoint);
+    frameDepth--;
+}
+
+/** @brief Same as Search, but the branches that delay a different number of jobs 
+ *         are searched on the thread pool, each on its own copy of the cluster. The
+ *         branches are compared in the same order as Search, so the result is the same.
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ *  @param resultUtility The total utility of the best branch, this is also a return value
+ *  @param result The decision of the best branch, this is also a return value. For each 
+ *                vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param plan The future decisions of the best branch, NULL if not needed
+ */
+void Cluster::SearchParallel(int step, int searchEndJobId, time_t curTime, double & resultUtility,
+                std::vector<std::vector<int> > & result, std::vector<PlanStep>* plan) {
+    if (step == 0 || searchEndJobId == -1) {
+        Search(step, searchEndJobId, curTime, resultUtility, &result, plan);
+        return;
+    }
+
+    size_t checkpoint = undoLog.size();
+
+    SearchFrame & frame = PushFrame();
+    std::vector<MyJob*> & potentialRunningJobs = frame.potentialRunningJobs;
+    std::vector<double> & potentialUtility = frame.potentialUtility;
+    potentialRunningJobs.clear();
+    potentialUtility.clear();
+    StartJobs(curTime, potentialRunningJobs, potentialUtility);
+
+    // Branch i delays the last i potential running jobs. The copies of the 
+    // branches of the last search are loaded again.
+    int branchNum = potentialRunningJobs.size() + 1;
+    if ((int)branches.size() < branchNum) {
+        SearchBranch empty = SearchBranch();
+        branches.resize(branchNum, empty);
+    }
+
+    for (int i = 0; i < branchNum; i++) {
+        SearchBranch* branch = &branches[i];
+        size_t branchCheckpoint = undoLog.size();
+        for (std::vector<MyJob*>::iterator it=potentialRunningJobs.begin(); 
+                                        it != potentialRunningJobs.end(); ++it){
+            PushRunningJob(*it);
+        }
+        if (branch->cluster == NULL)
+            branch->cluster = new Cluster(this);
+        else
+            branch->cluster->Load(this);
+        constructResult(potentialRunningJobs, branch->result);
+        branch->utility = SumUtility(potentialUtility);
+        branch->bound = BranchUpperBound(step, searchEndJobId, curTime);
+        branch->step = step;
+        branch->searchEndJobId = searchEndJobId;
+        branch->curTime = curTime;
+        branch->hasPlan = (plan != NULL);
+        Rollback(branchCheckpoint);
+
+        pool->Submit([branch]() {
+            branch->cluster->SimulateNext(branch->step, branch->searchEndJobId, branch->curTime, 
+                    branch->nextResultUtility, branch->hasPlan ? &branch->plan : NULL);
+        });
+
+        if (potentialRunningJobs.empty())
+            break;
+
+        MyJob* myjob = potentialRunningJobs.back();
+        potentialRunningJobs.pop_back();
+        potentialUtility.pop_back();
+
+        DelayLastStartedJob();
         FreeMachinesByJob(myjob);
     }
 
+    pool->Wait();
+
+    // Compare the branches in order, on a tie the branch that delays less wins. A 
+    // branch Search would skip by its upper bound is skipped here too.
+    resultUtility = -1;
+    for (int i = 0; i < branchNum; i++) {
+        SearchBranch & branch = branches[i];
+        if (branch.utility + branch.bound <= resultUtility) {
+            stats.prunedBranches++;
+        } else if (branch.utility + branch.nextResultUtility > resultUtility) {
+            resultUtility = branch.utility + branch.nextResultUtility;
+            result.swap(branch.result);
+            if (plan != NULL)
+                plan->swap(branch.plan);
+        }
+        Cluster* copy = branch.cluster;
+        stats.expandedNodes += copy->stats.expandedNodes;
+        stats.prunedBranches += copy->stats.prunedBranches;
+        stats.placementHits += copy->stats.placementHits;
+        stats.placementMisses += copy->stats.placementMisses;
+        stats.exactPacks += copy->stats.exactPacks;
+        stats.exactPackFallbacks += copy->stats.exactPackFallbacks;
+        stats.timedOut = stats.timedOut || copy->stats.timedOut;
+        // the job SimulateNext finished is only in the undo log of the branch
+        copy->Rollback(0);
+        copy->Clear();
+    }
+
+    Rollback(checkpoint);
+    frameDepth--;
+}
+
+/** @brief Bring the cluster to the state of a beam node, by starting the jobs of 
+ *         each of its steps and finishing the next running job after each step. 
+ *         The changes are left in the undo log.
+ *  @param node The beam node
+ *  @param curTime The time of the first step
+ */
+void Cluster::ReplayBeamNode(BeamNode & node, time_t curTime) {
+    time_t time = curTime;
+    for (unsigned int i = 0; i < node.decisions.size(); i++) {
+        std::vector<std::vector<int> > & decision = node.decisions[i];
+        std::vector<MyJob*> startedJobs;
+
+        for (unsigned int j = 0; j < decision.size(); j++) {
+            JobList::iterator jobIter = pendingJobList.begin();
+            while ((int)(*jobIter)->jobId != decision[j][0])
+                ++jobIter;
+
+            MyJob* job = *jobIter;
+            MachineSet machines;
+            for (unsigned int m = 2; m < decision[j].size(); m++)
+                machines.Insert(decision[j][m]);
+            StartPendingJob(jobIter);
+            AllocateMachinesToJob(job, machines, decision[j][1] == 1, time);
+            startedJobs.push_back(job);
+        }
+        for (unsigned int j = 0; j < startedJobs.size(); j++)
+            PushRunningJob(startedJobs[j]);
+
+        // the next step is when the job finishes, as in BeamSearch
+        MyJob* finishedJob = PopRunningJob();
+        if (difftime(finishedJob->GetFinishedTime(), time) > 0)
+            time = finishedJob->GetFinishedTime();
+        FreeMachinesByJob(finishedJob);
+    }
+}
+
+/** @brief Search the same delay decisions as Search, but breadth first, keeping only 
+ *         the beamWidth partial schedules with the highest utility plus the utility 
+ *         of a greedy decision at their next step.
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ *  @param resultUtility The total utility of the best complete schedule, -1 if the 
+ *                       deadline came before any schedule was complete
+ *  @param plan The future decisions of the best schedule, NULL if not needed
+ *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ */
+std::vector<std::vector<int> > Cluster::BeamSearch(int step, int searchEndJobId, time_t curTime, 
+                                            double & resultUtility, std::vector<PlanStep>* plan) {
+    std::vector<BeamNode> beam(1), candidates;
+    beam[0].utility = 0;
+    beam[0].score = 0;
+    beam[0].time = curTime;
+    beam[0].searchEndJobId = searchEndJobId;
+
+    BeamNode best;
+    resultUtility = -1;
+
+    for (int level = 0; level < step && !beam.empty(); level++) {
+        candidates.clear();
+
+        for (unsigned int b = 0; b < beam.size() && !IsTimeUp(); b++) {
+            BeamNode & node = beam[b];
+            size_t checkpoint = undoLog.size();
+            stats.expandedNodes++;
+
+            ReplayBeamNode(node, curTime);
+
+            std::vector<MyJob*> potentialRunningJobs;
+            std::vector<double> potentialUtility;
+            StartJobs(node.time, potentialRunningJobs, potentialUtility);
+
+            double curUtility = 0;
+            for (std::vector<double>::iterator it = potentialUtility.begin() ; it != potentialUtility.end(); ++it)
+                curUtility += *it;
+
+            // the children start all potential jobs, then one less each time
+            while (true) {
+                size_t branchCheckpoint = undoLog.size();
+                for (std::vector<MyJob*>::iterator it=potentialRunningJobs.begin(); 
+                                                it != potentialRunningJobs.end(); ++it){
+                    PushRunningJob(*it);
+                }
+
+                // the decision is taken before a job of it may finish and free its machines
+                BeamNode child;
+                child.decisions = node.decisions;
+                child.decisions.push_back(std::vector<std::vector<int> >());
+                constructResult(potentialRunningJobs, child.decisions.back());
+
+                MyJob* finishedJob = PopRunningJob();
+                int nextSearchEndJobId = ((int)finishedJob->jobId == node.searchEndJobId) ? 
+                                                                        -1 : node.searchEndJobId;
+                time_t nextTime = node.time;
+                if (difftime(finishedJob->GetFinishedTime(), node.time) > 0)
+                    nextTime = finishedJob->GetFinishedTime();
+                FreeMachinesByJob(finishedJob);
+
+                child.finishedJobs = node.finishedJobs;
+                child.finishedJobs.push_back(finishedJob->jobId);
+                child.finishTimes = node.finishTimes;
+                child.finishTimes.push_back(nextTime);
+                child.utility = node.utility + curUtility;
+                child.time = nextTime;
+                child.searchEndJobId = nextSearchEndJobId;
+
+                if (nextSearchEndJobId == -1 || level == step - 1) {
+                    // no more branching, the rest is decided as in Search
+                    double restUtility;
+                    std::vector<std::vector<int> > lastDecision;
+                    Search(0, nextSearchEndJobId, nextTime, restUtility, 
+                                    (nextSearchEndJobId == -1) ? &lastDecision : NULL, NULL);
+
+                    if (!stats.timedOut && child.utility + restUtility > resultUtility) {
+                        resultUtility = child.utility + restUtility;
+                        // the last decision is only made right at the finish if it ends the search
+                        if (nextSearchEndJobId == -1)
+                            child.decisions.push_back(lastDecision);
+                        std::swap(best, child);
+                    }
+                } else {
+                    size_t greedyCheckpoint = undoLog.size();
+                    std::vector<MyJob*> nextJobs;
+                    std::vector<double> nextUtility;
+                    GreedyStart(nextTime, nextJobs, nextUtility);
+                    Rollback(greedyCheckpoint);
+
+                    child.score = child.utility;
+                    for (std::vector<double>::iterator it = nextUtility.begin() ; it != nextUtility.end(); ++it)
+                        child.score += *it;
+                    candidates.push_back(child);
+                }
+                Rollback(branchCheckpoint);
+
+                if (potentialRunningJobs.empty())
+                    break;
+
+                MyJob* myjob = potentialRunningJobs.back();
+                potentialRunningJobs.pop_back();
+                curUtility -= potentialUtility.back();
+                potentialUtility.pop_back();
+
+                DelayLastStartedJob();
+                FreeMachinesByJob(myjob);
+            }
+
+            Rollback(checkpoint);
+        }
+
+        // keep the best beamWidth nodes, on a tie the one found first
+        std::stable_sort(candidates.begin(), candidates.end(), 
+                    [](const BeamNode & a, const BeamNode & b) { return a.score > b.score; });
+        if ((int)candidates.size() > params.beamWidth)
+            candidates.resize(params.beamWidth);
+        beam.swap(candidates);
+    }
+
+    if (resultUtility < 0)
+        return std::vector<std::vector<int> >();
+
+    if (plan != NULL) {
+        plan->clear();
+        for (unsigned int i = 1; i < best.decisions.size(); i++) {
+            PlanStep planStep;
+            planStep.finishedJobId = best.finishedJobs[i-1];
+            planStep.finishTime = best.finishTimes[i-1];
+            planStep.decision = best.decisions[i];
+            plan->push_back(planStep);
+        }
+    }
+    return best.decisions[0];
+}
+
+/** @brief One rollout from a node of the Monte Carlo search tree. In the tree the 
+ *         delay count is chosen by UCT, a new node is added, and below it no job 
+ *         is delayed. At the root the delayed jobs are the last of the greedy jobs
+ *         of the expected durations. After step steps the rest is decided as in 
+ *         Search.
+ *  @param node The tree node of this step, -1 below the tree
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ *  @param path The tree nodes of the rollout, the chosen child is added to it
+ *  @return The total utility of the rollout
+ */
+double Cluster::MctsRollout(int node, int step, int searchEndJobId, time_t curTime, 
+                                            std::vector<int> & path) {
+    double resultUtility;
+    if (step == 0 || searchEndJobId == -1) {
+        Search(0, searchEndJobId, curTime, resultUtility, NULL, NULL);
+        return resultUtility;
+    }
+
+    size_t checkpoint = undoLog.size();
+
+    std::vector<MyJob*> potentialRunningJobs;
+    std::vector<double> potentialUtility;
+    if (node == 0) {
+        // the root starts the greedy jobs of the expected durations, so an action 
+        // delays the same jobs in every rollout
+        for (unsigned int i = 0; i < mctsRootJobs.size(); i++) {
+            MyJob* job = mctsRootJobs[i];
+            StartPendingJob(pendingTable.GetNode(job->pendingIndex));
+            AllocateMachinesToJob(job, mctsRootMachines[i], mctsRootPrefered[i], curTime);
+            potentialRunningJobs.push_back(job);
+            potentialUtility.push_back(job->CalUtility(curTime, mctsRootPrefered[i]));
+        }
+    } else
+        GreedyStart(curTime, potentialRunningJobs, potentialUtility);
+
+    int actionNum = potentialRunningJobs.size() + 1;
+    int action = 0, nextNode = -1;
+    if (node != -1) {
+        stats.expandedNodes++;
+        if ((int)mctsTree[node].children.size() < actionNum)
+            mctsTree[node].children.resize(actionNum, -1);
+
+        // the first delay count never tried, else the one with the best UCT score
+        double bestScore = -1;
+        for (int i = 0; i < actionNum; i++) {
+            int child = mctsTree[node].children[i];
+            if (child == -1 || mctsTree[child].visits == 0) {
+                action = i;
+                break;
+            }
+
+            double score = mctsTree[child].value / mctsTree[child].visits / std::max(mctsMaxValue, 1.0)
+                + MCTS_EXPLORATION * sqrt(log(mctsTree[node].visits) / mctsTree[child].visits);
+            if (score > bestScore) {
+                bestScore = score;
+                action = i;
+            }
+        }
+
+        int child = mctsTree[node].children[action];
+        if (child == -1) {
+            MctsNode newNode;
+            newNode.visits = 0;
+            newNode.value = 0;
+            child = mctsTree.size();
+            mctsTree.push_back(newNode);
+            mctsTree[node].children[action] = child;
+        } else
+            nextNode = child;
+        path.push_back(child);
+    }
+
+    for (int i = 0; i < action; i++) {
+        MyJob* myjob = potentialRunningJobs.back();
+        potentialRunningJobs.pop_back();
+        potentialUtility.pop_back();
+
+        DelayLastStartedJob();
+        FreeMachinesByJob(myjob);
+    }
+
+    double curUtility = 0;
+    for (std::vector<double>::iterator it = potentialUtility.begin() ; it != potentialUtility.end(); ++it)
+        curUtility += *it;
+
+    for (std::vector<MyJob*>::iterator it=potentialRunningJobs.begin(); 
+                                    it != potentialRunningJobs.end(); ++it){
+        PushRunningJob(*it);
+    }
+
+    MyJob* finishedJob = PopRunningJob();
+    int nextSearchEndJobId = ((int)finishedJob->jobId == searchEndJobId) ? -1 : searchEndJobId;
+    time_t nextTime = curTime;
+    if (difftime(finishedJob->GetFinishedTime(), curTime) > 0)
+        nextTime = finishedJob->GetFinishedTime();
+    FreeMachinesByJob(finishedJob);
+
+    resultUtility = curUtility + MctsRollout(nextNode, step - 1, nextSearchEndJobId, nextTime, path);
+
+    Rollback(checkpoint);
+    return resultUtility;
+}
+
+/** @brief Grow a Monte Carlo search tree on this cluster. Every rollout samples 
+ *         the durations of all jobs around the expected ones.
+ *  @param iterations The number of rollouts
+ *  @param seed The seed of the sampled durations
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ */
+void Cluster::MctsWorker(int iterations, unsigned int seed, int step, int searchEndJobId, time_t curTime) {
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> perturb(0, params.durationPerturbStd);
+
+    std::vector<MyJob*> jobs(pendingJobList.begin(), pendingJobList.end());
+    jobs.insert(jobs.end(), runningJobList.GetJobs().begin(), runningJobList.GetJobs().end());
+    std::vector<double> durations, slowDurations;
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        durations.push_back(jobs[i]->duration);
+        slowDurations.push_back(jobs[i]->slowDuration);
+    }
+
+    MctsNode root;
+    root.visits = 0;
+    root.value = 0;
+    mctsTree.assign(1, root);
+    mctsMaxValue = 0;
+
+    // the greedy jobs of the root, at the expected durations as MctsSearch starts them
+    size_t checkpoint = undoLog.size();
+    std::vector<double> rootUtility;
+    mctsRootJobs.clear();
+    GreedyStart(curTime, mctsRootJobs, rootUtility);
+    mctsRootMachines.clear();
+    mctsRootPrefered.clear();
+    for (unsigned int i = 0; i < mctsRootJobs.size(); i++) {
+        mctsRootMachines.push_back(mctsRootJobs[i]->assignedMachines);
+        mctsRootPrefered.push_back(mctsRootJobs[i]->isPrefered);
+    }
+    Rollback(checkpoint);
+
+    for (int i = 0; i < iterations && !IsTimeUp(); i++) {
+        for (unsigned int j = 0; j < jobs.size(); j++) {
+            double factor = std::max(MCTS_MIN_DURATION_FACTOR, 1 + perturb(generator));
+            jobs[j]->duration = durations[j] * factor;
+            jobs[j]->slowDuration = slowDurations[j] * factor;
+            jobs[j]->UpdateFinishTime();
+        }
+        runningJobList.Rebuild();
+        pendingTable.Refresh();
+
+        std::vector<int> path(1, 0);
+        double value = MctsRollout(0, step, searchEndJobId, curTime, path);
+
+        // the rollout stopped in the middle, its utility is not complete
+        if (IsTimeUp())
+            break;
+
+        for (unsigned int j = 0; j < path.size(); j++) {
+            mctsTree[path[j]].visits++;
+            mctsTree[path[j]].value += value;
+        }
+        mctsMaxValue = std::max(mctsMaxValue, value);
+    }
+
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        jobs[i]->duration = durations[i];
+        jobs[i]->slowDuration = slowDurations[i];
+        jobs[i]->UpdateFinishTime();
+    }
+    runningJobList.Rebuild();
+    pendingTable.Refresh();
+}
+
+/** @brief Choose how many of the greedy jobs to delay by Monte Carlo tree search 
+ *         over sampled durations. With a thread pool every thread grows its own 
+ *         tree and the visits of the first level are added up.
+ *  @param step The number of search step
+ *  @param searchEndJobId The job which is the end of the search process
+ *  @param curTime "Current" time of simulation
+ *  @param resultUtility The mean utility of the rollouts of the chosen delay count, 
+ *                       -1 if no rollout finished before the deadline
+ *  @return The greedy jobs without the delayed ones, in the format of Search
+ */
+std::vector<std::vector<int> > Cluster::MctsSearch(int step, int searchEndJobId, time_t curTime, 
+                                            double & resultUtility) {
+    int treeNum = (pool != NULL) ? pool->Size() : 1;
+    int iterations = (params.mctsIterations + treeNum - 1) / treeNum;
+
+    std::vector<Cluster*> trees(treeNum);
+    for (int i = 0; i < treeNum; i++) {
+        Cluster* tree = new Cluster(this);
+        // the sampled durations change the finish times, cached utilities do not apply
+        tree->table = NULL;
+        trees[i] = tree;
+        if (pool != NULL)
+            pool->Submit([=]() { tree->MctsWorker(iterations, i, step, searchEndJobId, curTime); });
+        else
+            tree->MctsWorker(iterations, i, step, searchEndJobId, curTime);
+    }
+    if (pool != NULL)
+        pool->Wait();
+
+    std::vector<int> visits;
+    std::vector<double> values;
+    for (int i = 0; i < treeNum; i++) {
+        std::vector<int> & children = trees[i]->mctsTree[0].children;
+        if (visits.size() < children.size()) {
+            visits.resize(children.size(), 0);
+            values.resize(children.size(), 0);
+        }
+        for (unsigned int j = 0; j < children.size(); j++) {
+            if (children[j] != -1) {
+                visits[j] += trees[i]->mctsTree[children[j]].visits;
+                values[j] += trees[i]->mctsTree[children[j]].value;
+            }
+        }
+
+        stats.expandedNodes += trees[i]->stats.expandedNodes;
+        stats.placementHits += trees[i]->stats.placementHits;
+        stats.placementMisses += trees[i]->stats.placementMisses;
+        stats.exactPacks += trees[i]->stats.exactPacks;
+        stats.exactPackFallbacks += trees[i]->stats.exactPackFallbacks;
+        stats.timedOut = stats.timedOut || trees[i]->stats.timedOut;
+        trees[i]->Clear();
+        delete trees[i];
+    }
+
+    // the most visited delay count, on a tie the one that delays less
+    int bestAction = -1;
+    for (unsigned int i = 0; i < visits.size(); i++) {
+        if (visits[i] > 0 && (bestAction == -1 || visits[i] > visits[bestAction]))
+            bestAction = i;
+    }
+
+    resultUtility = -1;
+    if (bestAction == -1)
+        return std::vector<std::vector<int> >();
+    resultUtility = values[bestAction] / visits[bestAction];
+
+    // apply the delay count to the greedy jobs of the expected durations
+    size_t checkpoint = undoLog.size();
+    std::vector<MyJob*> potentialRunningJobs;
+    std::vector<double> potentialUtility;
+    GreedyStart(curTime, potentialRunningJobs, potentialUtility);
+    for (int i = 0; i < bestAction && !potentialRunningJobs.empty(); i++) {
+        MyJob* myjob = potentialRunningJobs.back();
+        potentialRunningJobs.pop_back();
+
+        DelayLastStartedJob();
+        FreeMachinesByJob(myjob);
+    }
+
+    std::vector<std::vector<int> > result;
+    constructResult(potentialRunningJobs, result);
+    Rollback(checkpoint);
     return result;
 }
 
-/** @brief Simulate the next seasrch step based on the last time.
+/** @brief Simulate the next seasrch step based on the last time. The changes are
+ *         left in the undo log, the caller rolls them back.
  *  @param step The number of search step
  *  @param searchEndJobId The job which is the end of the search process
  *  @param curTime The "current" time of simulation
  *  @param resultUtility The total utility of each search process
- *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param plan The decision when the next job finishes followed by the later ones, 
+ *              NULL if not needed, empty if the utility is taken from the transposition table
  */
-std::vector<std::vector<int> > Cluster::SimulateNext(int step, int searchEndJobId, time_t curTime, 
-                                                                                            double & resultUtility) {
-    MyJob* finishedJob = runningJobList.top();
-    runningJobList.pop();
+void Cluster::SimulateNext(int step, int searchEndJobId, time_t curTime, 
+                                            double & resultUtility, std::vector<PlanStep>* plan) {
+    if (plan != NULL)
+        plan->clear();
+
+    MyJob* finishedJob = PopRunningJob();
     
     // Check if it is the end job
     int nextSearchEndJobId = ((int)finishedJob->jobId == searchEndJobId) ? -1 : searchEndJobId;
 
-    FreeMachinesByJob(finishedJob);
-
     // the next time of simulated scheduling will happen when the job at the head of the runningJobList finish runnning
     time_t nextTime = curTime;
     if (difftime(finishedJob->GetFinishedTime(), curTime) > 0)
         nextTime = finishedJob->GetFinishedTime();
 
-    // Start the next step search based on the last decision.
-    return Search(step-1, nextSearchEndJobId, nextTime, resultUtility);
+    FreeMachinesByJob(finishedJob);
+
+    // A state that was searched before (e.g. reached by delaying jobs in another order) 
+    // has the same utility, take it from the table.
+    uint64_t key = 0;
+    if (table != NULL) {
+        key = stateHash ^ TranspositionTable::HashKey(HASH_SEARCH, 
+                        ((uint64_t)(step-1) << 32) | (uint32_t)nextSearchEndJobId, nextTime);
+        if (table->Probe(key, resultUtility))
+            return;
+    }
+
+    // Start the next step search based on the last decision. The decision is only 
+    // needed for the plan.
+    std::vector<PlanStep> nextPlan;
+    std::vector<std::vector<int> > result;
+    Search(step-1, nextSearchEndJobId, nextTime, resultUtility, (plan != NULL) ? &result : NULL,
+                                                                (plan != NULL) ? &nextPlan : NULL);
+    if (table != NULL && !stats.timedOut)
+        table->Store(key, resultUtility);
+
+    // The plan goes on only while a decision is searched right when the job finishes. 
+    if (plan != NULL && (step > 1 || nextSearchEndJobId == -1)) {
+        plan->resize(1);
+        plan->front().finishedJobId = finishedJob->jobId;
+        plan->front().finishTime = nextTime;
+        plan->front().decision.swap(result);
+        plan->insert(plan->end(), nextPlan.begin(), nextPlan.end());
+    }
 }
 
-/** @brief Get job info and allocated machines from the potential jobs.
+/** @brief Get job info and allocated machines from the potential jobs. The 
+ *         vectors already in result and the spare rows are reused.
  *  @jobs The vector of jobs that will run potentially
- *  @return For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
+ *  @param result For each vector, 0 is jobID, 1 indicates if is prefered, 2...n is machine ID
  */
-std::vector<std::vector<int> > Cluster::constructResult(std::vector<MyJob*> & jobs) {
-    std::vector<std::vector<int> > result;
+void Cluster::constructResult(std::vector<MyJob*> & jobs, std::vector<std::vector<int> > & result) {
+    ResizeResult(result, jobs.size());
 
-    for (std::vector<MyJob*>::iterator it=jobs.begin(); 
-                                        it != jobs.end(); ++it) {
-        std::vector<int> tmp;
-        tmp.push_back((*it)->jobId);
-        tmp.push_back((*it)->isPrefered);
-        for (std::set<int32_t>::iterator i=(*it)->assignedMachines.begin(); 
-                                        i != (*it)->assignedMachines.end(); ++i) {
+    for (unsigned int j = 0; j < jobs.size(); j++) {
+        std::vector<int> & tmp = result[j];
+        tmp.clear();
+        tmp.push_back(jobs[j]->jobId);
+        tmp.push_back(jobs[j]->isPrefered);
+        for (MachineSet::const_iterator i=jobs[j]->assignedMachines.begin(); 
+                                        i != jobs[j]->assignedMachines.end(); ++i) {
             tmp.push_back(*i);
         }
-
-        result.push_back(tmp);
     }
-    return result;
 }
 
-
+/** @brief Resize a decision, the rows it drops are kept as spare rows and the rows 
+ *         it gets are taken from them, so the memory of the rows is reused.
+ *  @param result The decision
+ *  @param size The number of rows
+ */
+void Cluster::ResizeResult(std::vector<std::vector<int> > & result, size_t size) {
+    while (result.size() > size) {
+        spareRows.push_back(std::vector<int>());
+        spareRows.back().swap(result.back());
+        result.pop_back();
+    }
+    while (result.size() < size) {
+        result.push_back(std::vector<int>());
+        if (!spareRows.empty()) {
+            result.back().swap(spareRows.back());
+            spareRows.pop_back();
+        }
+    }
+    // there is room for the rows when they are dropped again
+    if (spareRows.capacity() < spareRows.size() + size)
+        spareRows.reserve(spareRows.size() + size);
+}
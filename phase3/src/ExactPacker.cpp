@@ -0,0 +1,175 @@
+/** @file ExactPacker.cpp
+ *  @brief This file contains implementation of the ExactPacker, the dynamic
+ *         program that picks the pending jobs of one decision.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <algorithm>
+
+/** @brief Constructor of a packer with no states yet. */
+ExactPacker::ExactPacker() {
+    isSoft = true;
+    maxStates = 0;
+    items = NULL;
+    overflow = false;
+}
+
+/** @brief Make the memo key of a state.
+ *  @param index The first job not decided yet
+ *  @param gpuFree The free machines of the GPU rack
+ *  @param reserved The machines taken by the jobs on any machines
+ *  @param free The free machines of the other racks, sorted, without the full racks
+ *  @return The key
+ */
+std::string ExactPacker::StateKey(int index, int gpuFree, int reserved,
+                                                const std::vector<int> & free) const {
+    std::string key;
+    key.reserve((free.size() + 3) * sizeof(int));
+    key.append((const char*)&index, sizeof(int));
+    key.append((const char*)&gpuFree, sizeof(int));
+    key.append((const char*)&reserved, sizeof(int));
+    key.append((const char*)free.data(), free.size() * sizeof(int));
+    return key;
+}
+
+/** @brief Find the best utility of the jobs from index on, and memoise the choice
+ *         of the job at index. The jobs on any machines only need as many free
+ *         machines left after the preferred ones as they reserved.
+ *  @param index The first job not decided yet
+ *  @param gpuFree The free machines of the GPU rack
+ *  @param reserved The machines taken by the jobs on any machines
+ *  @param free The free machines of the other racks, sorted, without the full racks
+ *  @return The utility, 0 once the states went over maxStates
+ */
+double ExactPacker::Solve(int index, int gpuFree, int reserved, std::vector<int> & free) {
+    if (overflow || index == (int)items->size())
+        return 0;
+
+    std::string key = StateKey(index, gpuFree, reserved, free);
+    std::unordered_map<std::string, Memo>::const_iterator found = memo.find(key);
+    if (found != memo.end())
+        return found->second.utility;
+
+    const Item & item = (*items)[index];
+    int k = item.k;
+    int totalFree = gpuFree;
+    for (unsigned int i = 0; i < free.size(); i++)
+        totalFree += free[i];
+
+    Memo best;
+    best.choice = PACK_SKIP;
+    best.utility = Solve(index + 1, gpuFree, reserved, free);
+
+    if (item.preferedUtility > 0 && totalFree - k >= reserved) {
+        // an MPI job on one rack, the one with the fewest free machines first as 
+        // GetMachinesForMPI does
+        if (item.jobType == job_t::JOB_MPI) {
+            for (unsigned int i = 0; i < free.size(); i++) {
+                int count = free[i];
+                if (count < k || (i > 0 && free[i - 1] == count))
+                    continue;
+                std::vector<int> next(free);
+                next.erase(next.begin() + i);
+                if (count > k)
+                    next.insert(std::lower_bound(next.begin(), next.end(), count - k), count - k);
+                double utility = item.preferedUtility + Solve(index + 1, gpuFree, reserved, next);
+                if (utility > best.utility) {
+                    best.utility = utility;
+                    best.choice = count + 1;
+                }
+            }
+        }
+
+        if (gpuFree >= k) {
+            double utility = item.preferedUtility + Solve(index + 1, gpuFree - k, reserved, free);
+            if (utility > best.utility) {
+                best.utility = utility;
+                best.choice = 0;
+            }
+        }
+    }
+
+    if (isSoft && item.slowUtility > 0 && reserved + k <= totalFree) {
+        double utility = item.slowUtility + Solve(index + 1, gpuFree, reserved + k, free);
+        if (utility > best.utility) {
+            best.utility = utility;
+            best.choice = PACK_ANY;
+        }
+    }
+
+    memo[key] = best;
+    if (memo.size() > maxStates)
+        overflow = true;
+    return best.utility;
+}
+
+/** @brief Find the jobs to start with the highest total utility. On a tie a job
+ *         is rather skipped, then rather on its preferred machines.
+ *  @param freeCounts The free machines of every rack, rack 0 is the GPU rack
+ *  @param items The jobs
+ *  @param isSoft true if a job may start on machines it does not prefer
+ *  @param maxStates The most states to look at
+ *  @param choices For each job, PACK_SKIP, PACK_ANY or the rack of its preferred
+ *                 machines, this is also a return value
+ *  @return false if there were more than maxStates states, then choices is not set
+ */
+bool ExactPacker::Pack(const std::vector<int> & freeCounts, const std::vector<Item> & items,
+                        bool isSoft, size_t maxStates, std::vector<int> & choices) {
+    this->isSoft = isSoft;
+    this->maxStates = maxStates;
+    this->items = &items;
+    this->overflow = false;
+    memo.clear();
+
+    std::vector<int> free;
+    for (unsigned int r = 1; r < freeCounts.size(); r++) {
+        if (freeCounts[r] > 0)
+            free.push_back(freeCounts[r]);
+    }
+    std::sort(free.begin(), free.end());
+    int gpuFree = freeCounts.empty() ? 0 : freeCounts[0];
+
+    Solve(0, gpuFree, 0, free);
+    if (overflow) {
+        memo.clear();
+        return false;
+    }
+
+    // follow the memoised choices, a rack of some free count is the first such rack
+    std::vector<int> rackFree(freeCounts);
+    int reserved = 0;
+    choices.assign(items.size(), PACK_SKIP);
+    for (unsigned int i = 0; i < items.size(); i++) {
+        int choice = memo[StateKey(i, gpuFree, reserved, free)].choice;
+        int k = items[i].k;
+        if (choice == PACK_SKIP)
+            continue;
+
+        if (choice == PACK_ANY) {
+            reserved += k;
+            choices[i] = PACK_ANY;
+        } else if (choice == 0) {
+            gpuFree -= k;
+            rackFree[0] -= k;
+            choices[i] = 0;
+        } else {
+            int count = choice - 1;
+            unsigned int rack = 1;
+            while (rackFree[rack] != count)
+                rack++;
+            rackFree[rack] -= k;
+            choices[i] = rack;
+
+            free.erase(std::lower_bound(free.begin(), free.end(), count));
+            if (count > k)
+                free.insert(std::lower_bound(free.begin(), free.end(), count - k), count - k);
+        }
+    }
+    memo.clear();
+    return true;
+}
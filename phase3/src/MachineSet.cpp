@@ -0,0 +1,184 @@
+/** @file MachineSet.cpp
+ *  @brief This file contains implementation of the MachineSet, the compact
+ *         set of machine ids of a job.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <algorithm>
+
+/** @brief Constructor of an empty set. */
+MachineSet::MachineSet() {
+    count = 0;
+}
+
+/** @brief Find the smallest id in the bitmap from an id on.
+ *  @param from the first id to check
+ *  @return the id, or the end of the bitmap if there is none
+ */
+int MachineSet::NextBit(int from) const {
+    int end = bits.size() * 64;
+    if (from >= end)
+        return end;
+
+    int word = from / 64;
+    uint64_t rest = bits[word] & (~(uint64_t)0 << (from % 64));
+    while (rest == 0) {
+        if (++word == (int)bits.size())
+            return end;
+        rest = bits[word];
+    }
+    return word * 64 + __builtin_ctzll(rest);
+}
+
+/** @brief Add a machine, nothing happens if it is already in the set.
+ *  @param id the machine id
+ */
+void MachineSet::Insert(int32_t id) {
+    if (bits.empty()) {
+        int pos = 0;
+        while (pos < count && inlineIds[pos] < id)
+            pos++;
+        if (pos < count && inlineIds[pos] == id)
+            return;
+
+        if (count < INLINE_SIZE) {
+            for (int i = count; i > pos; i--)
+                inlineIds[i] = inlineIds[i - 1];
+            inlineIds[pos] = id;
+            count++;
+            return;
+        }
+
+        // too many machines to keep inline, move them to the bitmap
+        int maxId = std::max(id, inlineIds[count - 1]);
+        bits.assign(maxId / 64 + 1, 0);
+        for (int i = 0; i < count; i++)
+            bits[inlineIds[i] / 64] |= (uint64_t)1 << (inlineIds[i] % 64);
+    }
+
+    if (id / 64 >= (int)bits.size())
+        bits.resize(id / 64 + 1, 0);
+    uint64_t bit = (uint64_t)1 << (id % 64);
+    if (!(bits[id / 64] & bit)) {
+        bits[id / 64] |= bit;
+        count++;
+    }
+}
+
+/** @brief Remove a machine.
+ *  @param id the machine id
+ *  @return true if the machine was in the set
+ */
+bool MachineSet::Erase(int32_t id) {
+    if (bits.empty()) {
+        for (int pos = 0; pos < count; pos++) {
+            if (inlineIds[pos] == id) {
+                for (int i = pos + 1; i < count; i++)
+                    inlineIds[i - 1] = inlineIds[i];
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (!Contains(id))
+        return false;
+    bits[id / 64] &= ~((uint64_t)1 << (id % 64));
+    count--;
+    return true;
+}
+
+/** @brief Check if a machine is in the set.
+ *  @param id the machine id
+ */
+bool MachineSet::Contains(int32_t id) const {
+    if (bits.empty()) {
+        for (int i = 0; i < count; i++)
+            if (inlineIds[i] == id)
+                return true;
+        return false;
+    }
+    return id / 64 < (int)bits.size() && (bits[id / 64] >> (id % 64)) & 1;
+}
+
+/** @brief Get the number of machines in the set */
+int MachineSet::Size() const {
+    return count;
+}
+
+/** @brief Check if the set is empty */
+bool MachineSet::Empty() const {
+    return count == 0;
+}
+
+/** @brief Remove all machines, the set goes back to inline ids. */
+void MachineSet::Clear() {
+    bits.clear();
+    count = 0;
+}
+
+/** @brief Exchange the content with another set.
+ *  @param other the other set
+ */
+void MachineSet::Swap(MachineSet & other) {
+    std::swap(inlineIds, other.inlineIds);
+    bits.swap(other.bits);
+    std::swap(count, other.count);
+}
+
+/** @brief Iterate from the smallest id */
+MachineSet::const_iterator MachineSet::begin() const {
+    return const_iterator(this, bits.empty() ? 0 : NextBit(0));
+}
+
+/** @brief The end of the iteration */
+MachineSet::const_iterator MachineSet::end() const {
+    return const_iterator(this, bits.empty() ? count : bits.size() * 64);
+}
+
+/** @brief Convert to the set type of the Thrift interface */
+std::set<int32_t> MachineSet::ToSet() const {
+    std::set<int32_t> result;
+    for (const_iterator it = begin(); it != end(); ++it)
+        result.insert(result.end(), *it);
+    return result;
+}
+
+/** @brief Constructor.
+ *  @param set the iterated set
+ *  @param pos the index in the inline ids, or the id in the bitmap
+ */
+MachineSet::const_iterator::const_iterator(const MachineSet* set, int pos) {
+    this->set = set;
+    this->pos = pos;
+}
+
+/** @brief Get the current id */
+int32_t MachineSet::const_iterator::operator*() const {
+    return set->bits.empty() ? set->inlineIds[pos] : pos;
+}
+
+/** @brief Move to the next id */
+MachineSet::const_iterator & MachineSet::const_iterator::operator++() {
+    if (set->bits.empty())
+        pos++;
+    else
+        pos = set->NextBit(pos + 1);
+    return *this;
+}
+
+/** @brief Check if two iterators are at the same id of the same set */
+bool MachineSet::const_iterator::operator==(const const_iterator & other) const {
+    return set == other.set && pos == other.pos;
+}
+
+/** @brief Check if two iterators are at different ids */
+bool MachineSet::const_iterator::operator!=(const const_iterator & other) const {
+    return !(*this == other);
+}
@@ -31,6 +31,10 @@ MyJob::MyJob(JobID jobId, job_t::type jobType, int32_t k, double duration,
 
 
     this->startTime = -1;
+    this->finishTime = -1;
+    this->isPrefered = false;
+    this->heapIndex = -1;
+    this->pendingIndex = -1;
 }
 
 /** @brief Constructor with another job.
@@ -44,32 +48,37 @@ MyJob::MyJob(MyJob* job) {
     slowDuration = job->slowDuration;
     arriveTime = job->arriveTime;
     startTime = job->startTime;
+    finishTime = job->finishTime;
     isPrefered = job->isPrefered;
     assignedMachines = job->assignedMachines;
+    heapIndex = -1;
+    pendingIndex = -1;
 }
 
 /** @brief Start the job with allocated machines.
  *  @param machines Machines that allocated to the job
  *  @param isPrefered true if the job running in the preferred resources.
+ *  @param startTime The time the job starts, simulated in a search
  */
-void MyJob::Start(std::set<int32_t> & machines, bool isPrefered) {
-    time(&this->startTime);
+void MyJob::Start(const MachineSet & machines, bool isPrefered, time_t startTime) {
+    this->startTime = startTime;
     this->isPrefered = isPrefered;
     this->assignedMachines = machines;
+    UpdateFinishTime();
 }
 
 /** @brief Free the machine that allocated to the job.
  *  @param machineID The id of the free machine 
  */
 void MyJob::FreeMachine(int machineID) {
-    this->assignedMachines.erase(machineID);
+    this->assignedMachines.Erase(machineID);
 }
 
 /** @brief Check if the job is finished or not.
  *  @return true if the job finished, else return false
  */
 bool MyJob::IsFinished() {
-    if (this->assignedMachines.size() == 0)
+    if (this->assignedMachines.Size() == 0)
         return true;
     else
         return false;
@@ -88,10 +97,17 @@ double MyJob::CalUtility(time_t curTime, bool isPrefered) {
     return result < 0 ? 0 : result;
 }
 
+/** @brief Compute the finish time again, after the start time, the 
+ *         durations or the preference of the job changed.
+ */
+void MyJob::UpdateFinishTime() {
+    double runningTime = isPrefered ? duration : slowDuration;
+    finishTime = startTime + (int)runningTime;
+}
+
 /** @brief Get the finished time of the job.
  *  @return finished time
  */
 time_t MyJob::GetFinishedTime() {
-    double runningTime = isPrefered ? duration : slowDuration;
-    return startTime + (int)runningTime;
+    return finishTime;
 }
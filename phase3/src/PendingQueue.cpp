@@ -0,0 +1,79 @@
+/** @file PendingQueue.cpp
+ *  @brief This file contains implementation of the PendingQueue, the pending 
+ *         jobs of the server in arrival order with lookup and removal by job id.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Add a job at the end of the queue.
+ *  @param job The job, its id must not be in the queue
+ */
+void PendingQueue::PushBack(MyJob* job) {
+    jobs.push_back(job);
+    index[job->jobId] = --jobs.end();
+}
+
+/** @brief Get the earliest job, the queue must not be empty */
+MyJob* PendingQueue::Front() const {
+    return jobs.front();
+}
+
+/** @brief Remove the earliest job, the queue must not be empty */
+void PendingQueue::PopFront() {
+    index.erase(jobs.front()->jobId);
+    jobs.pop_front();
+}
+
+/** @brief Find a job by its id.
+ *  @param jobId The job id
+ *  @return the job, NULL if it is not in the queue
+ */
+MyJob* PendingQueue::Find(JobID jobId) const {
+    std::unordered_map<JobID, std::list<MyJob*>::iterator>::const_iterator it = index.find(jobId);
+    if (it == index.end())
+        return NULL;
+    return *(it->second);
+}
+
+/** @brief Remove a job by its id, the job itself is not deleted.
+ *  @param jobId The job id
+ *  @return true if the job was in the queue
+ */
+bool PendingQueue::Erase(JobID jobId) {
+    std::unordered_map<JobID, std::list<MyJob*>::iterator>::iterator it = index.find(jobId);
+    if (it == index.end())
+        return false;
+    jobs.erase(it->second);
+    index.erase(it);
+    return true;
+}
+
+/** @brief Check if the queue is empty */
+bool PendingQueue::Empty() const {
+    return jobs.empty();
+}
+
+/** @brief Get the number of jobs in the queue */
+size_t PendingQueue::Size() const {
+    return jobs.size();
+}
+
+/** @brief Iterate the jobs in arrival order */
+PendingQueue::const_iterator PendingQueue::begin() const {
+    return jobs.begin();
+}
+
+/** @brief The end of the iteration */
+PendingQueue::const_iterator PendingQueue::end() const {
+    return jobs.end();
+}
+
+/** @brief Get the jobs in arrival order, as the search snapshots take them */
+const std::list<MyJob*> & PendingQueue::GetList() const {
+    return jobs;
+}
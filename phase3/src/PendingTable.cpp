@@ -0,0 +1,288 @@
+/** @file PendingTable.cpp
+ *  @brief This file contains implementation of the PendingTable, the pending
+ *         jobs of a cluster stored as columns for the utility passes.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <algorithm>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define PENDING_TABLE_AVX2
+# include <immintrin.h>
+#endif
+
+#ifdef PENDING_TABLE_AVX2
+/** @brief Check once if the CPU runs AVX2.
+ *  @return true if the AVX2 passes can be used
+ */
+static bool HasAvx2() {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+}
+
+/** @brief The AVX2 pass of ComputeUtility, for the first n / 4 * 4 rows.
+ *  @return The number of rows done
+ */
+__attribute__((target("avx2")))
+static int ComputeUtilityAvx2(int n, double curTime, const double* arriveTimes,
+                const double* durations, const double* slowDurations,
+                double* preferedUtility, double* slowUtility) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d limit = _mm256_set1_pd(1200);
+    const __m256d now = _mm256_set1_pd(curTime);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d waitingTime = _mm256_max_pd(_mm256_sub_pd(now, _mm256_loadu_pd(arriveTimes + i)), zero);
+        __m256d left = _mm256_sub_pd(limit, waitingTime);
+        _mm256_storeu_pd(preferedUtility + i,
+                _mm256_max_pd(_mm256_sub_pd(left, _mm256_loadu_pd(durations + i)), zero));
+        _mm256_storeu_pd(slowUtility + i,
+                _mm256_max_pd(_mm256_sub_pd(left, _mm256_loadu_pd(slowDurations + i)), zero));
+    }
+    return i;
+}
+#endif
+
+/** @brief Fill the table with the pending jobs of a cluster. The rows are in job
+ *         id order, so the first of equal utilities is the smallest job id.
+ *  @param pendingJobList The pending jobs, their list nodes must stay valid
+ */
+void PendingTable::Build(JobList & pendingJobList) {
+    nodes.clear();
+    for (JobList::iterator i=pendingJobList.begin(); i != pendingJobList.end(); ++i)
+        nodes.push_back(i);
+    std::sort(nodes.begin(), nodes.end(),
+            [](const JobList::iterator & a, const JobList::iterator & b) {
+                return (*a)->jobId < (*b)->jobId;
+            });
+
+    int n = nodes.size();
+    jobs.resize(n);
+    arriveTimes.resize(n);
+    durations.resize(n);
+    slowDurations.resize(n);
+    fitKs.resize(n);
+    ks.resize(n);
+    types.resize(n);
+    shapes.resize(n);
+    shapeNum = 0;
+    preferedUtility.resize(n);
+    slowUtility.resize(n);
+    orderTime = 0;
+    for (int i = 0; i < n; i++) {
+        MyJob* job = *nodes[i];
+        jobs[i] = job;
+        job->pendingIndex = i;
+        arriveTimes[i] = job->arriveTime;
+        fitKs[i] = job->k;
+        ks[i] = job->k;
+        types[i] = job->jobType;
+        orderTime = std::max(orderTime, arriveTimes[i]);
+
+        // the first row of a type and k gives the shape its id
+        int shape = 0;
+        while (shape < shapeNum && (types[shapeRows[shape][0]] != types[i] 
+                                    || ks[shapeRows[shape][0]] != ks[i]))
+            shape++;
+        if (shape == shapeNum) {
+            if (shapeNum == (int)shapeRows.size())
+                shapeRows.push_back(std::vector<int>());
+            shapeRows[shapeNum++].clear();
+        }
+        shapes[i] = shape;
+        shapeRows[shape].push_back(i);
+    }
+    Refresh();
+}
+
+/** @brief Mark a job of the table as pending or started.
+ *  @param job The job
+ *  @param isPending true if the job is back in the pending list
+ */
+void PendingTable::SetPending(MyJob* job, bool isPending) {
+    int row = job->pendingIndex;
+    fitKs[row] = isPending ? ks[row] : std::numeric_limits<double>::infinity();
+}
+
+/** @brief Read the durations of the jobs again, after they are changed. */
+void PendingTable::Refresh() {
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        durations[i] = jobs[i]->duration;
+        slowDurations[i] = jobs[i]->slowDuration;
+    }
+    SortShapes();
+}
+
+/** @brief Order the rows of every shape by each utility at orderTime, equal 
+ *         utilities by job id.
+ */
+void PendingTable::SortShapes() {
+    int n = jobs.size();
+    ComputeUtility(orderTime);
+    orderUtility.resize(n * ORDER_NUM);
+    for (int i = 0; i < n; i++) {
+        orderUtility[i * ORDER_NUM + ORDER_PREFERED] = preferedUtility[i];
+        orderUtility[i * ORDER_NUM + ORDER_SLOW] = slowUtility[i];
+        orderUtility[i * ORDER_NUM + ORDER_BEST] = std::max(preferedUtility[i], slowUtility[i]);
+    }
+
+    if ((int)shapeOrders.size() < shapeNum * ORDER_NUM)
+        shapeOrders.resize(shapeNum * ORDER_NUM);
+    heads.assign(shapeNum * ORDER_NUM, 0);
+    for (int shape = 0; shape < shapeNum; shape++) {
+        for (int order = 0; order < ORDER_NUM; order++) {
+            std::vector<int> & rows = shapeOrders[shape * ORDER_NUM + order];
+            rows = shapeRows[shape];
+            const double* utility = orderUtility.data() + order;
+            std::sort(rows.begin(), rows.end(), [utility](int a, int b) {
+                        double utilityA = utility[a * ORDER_NUM], utilityB = utility[b * ORDER_NUM];
+                        if (utilityA != utilityB)
+                            return utilityA > utilityB;
+                        return a < b;
+                    });
+        }
+    }
+}
+
+/** @brief Compute one utility of a row, the same as MyJob::CalUtility.
+ *  @param row The row
+ *  @param order The utility, ORDER_BEST is the higher of the other two
+ *  @param curTime The time the job starts
+ *  @return The utility
+ */
+double PendingTable::CalUtility(int row, int order, double curTime) const {
+    double duration = durations[row];
+    if (order == ORDER_SLOW)
+        duration = slowDurations[row];
+    else if (order == ORDER_BEST)
+        duration = std::min(durations[row], slowDurations[row]);
+    double waitingTime = std::max(curTime - arriveTimes[row], 0.0);
+    return std::max(1200 - waitingTime - duration, 0.0);
+}
+
+/** @brief Compute the utility of every job on preferred and on other machines,
+ *         the same as CalUtility.
+ *  @param curTime The time the jobs start
+ */
+void PendingTable::ComputeUtility(double curTime) {
+    int n = jobs.size();
+    int i = 0;
+#ifdef PENDING_TABLE_AVX2
+    if (HasAvx2())
+        i = ComputeUtilityAvx2(n, curTime, arriveTimes.data(), durations.data(),
+                    slowDurations.data(), preferedUtility.data(), slowUtility.data());
+#endif
+    for (; i < n; i++) {
+        double waitingTime = std::max(curTime - arriveTimes[i], 0.0);
+        preferedUtility[i] = std::max(1200 - waitingTime - durations[i], 0.0);
+        slowUtility[i] = std::max(1200 - waitingTime - slowDurations[i], 0.0);
+    }
+}
+
+/** @brief Get the shape of the job of a row.
+ *  @param row The row
+ *  @return The shape, from 0 to GetShapeNum() - 1
+ */
+int PendingTable::GetShape(int row) const {
+    return shapes[row];
+}
+
+/** @brief Get the number of shapes of the jobs.
+ *  @return The number of shapes
+ */
+int PendingTable::GetShapeNum() const {
+    return shapeNum;
+}
+
+/** @brief Start a new pass over the shape orders, with every pending job. */
+void PendingTable::ResetHeads() {
+    heads.assign(heads.size(), 0);
+}
+
+/** @brief Find the pending job of a shape with the highest utility, the smallest 
+ *         job id on a tie. The started jobs before it are skipped until the next 
+ *         ResetHeads, so no job may become pending in between. Every job must 
+ *         have arrived by curTime.
+ *  @param shape The shape
+ *  @param order The utility
+ *  @param curTime The time the job starts
+ *  @param utility The utility of the job, this is also a return value
+ *  @return The row, -1 if no job of the shape is pending
+ */
+int PendingTable::GetHead(int shape, Order order, time_t curTime, double & utility) {
+    const std::vector<int> & rows = shapeOrders[shape * ORDER_NUM + order];
+    unsigned int & head = heads[shape * ORDER_NUM + order];
+    while (head < rows.size() && fitKs[rows[head]] > ks[rows[head]])
+        head++;
+    if (head == rows.size())
+        return -1;
+
+    int best = rows[head];
+    utility = CalUtility(best, order, curTime);
+    if (utility <= 0)
+        return best;
+
+    // All utilities drop by the same time after orderTime, so the order still holds,
+    // except that rounding may tie utilities that were apart, or swap the ones that 
+    // were tied. Those rows come right after the head.
+    double headOrderUtility = orderUtility[best * ORDER_NUM + order];
+    for (unsigned int i = head + 1; i < rows.size(); i++) {
+        int row = rows[i];
+        if (fitKs[row] > ks[row])
+            continue;
+        double rowUtility = CalUtility(row, order, curTime);
+        if (orderUtility[row * ORDER_NUM + order] != headOrderUtility && rowUtility < utility)
+            break;
+        if (rowUtility > utility || (rowUtility == utility && row < best)) {
+            best = row;
+            utility = rowUtility;
+        }
+    }
+    return best;
+}
+
+/** @brief Get the job type of a shape.
+ *  @param shape The shape
+ *  @return The job type
+ */
+job_t::type PendingTable::GetShapeType(int shape) const {
+    return (job_t::type)types[shapeRows[shape][0]];
+}
+
+/** @brief Get the number of machines of a shape.
+ *  @param shape The shape
+ *  @return The number of machines
+ */
+int PendingTable::GetShapeK(int shape) const {
+    return ks[shapeRows[shape][0]];
+}
+
+/** @brief Get the type of the job of a row.
+ *  @param row The row
+ *  @return The job type
+ */
+job_t::type PendingTable::GetType(int row) const {
+    return (job_t::type)types[row];
+}
+
+/** @brief Get the number of machines of the job of a row.
+ *  @param row The row
+ *  @return The number of machines
+ */
+int PendingTable::GetK(int row) const {
+    return ks[row];
+}
+
+/** @brief Get the node of the job of a row in the pending list.
+ *  @param row The row
+ *  @return The list node
+ */
+JobList::iterator PendingTable::GetNode(int row) const {
+    return nodes[row];
+}
@@ -0,0 +1,54 @@
+/** @file PlacementCache.cpp
+ *  @brief This file contains implementation of the PlacementCache, which keeps
+ *         the racks of the placements found by a cluster.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Constructor. The entries are allocated when the first one is stored.
+ *  @param size The number of entries, a power of 2
+ */
+PlacementCache::PlacementCache(size_t size) {
+    this->size = size;
+}
+
+/** @brief Look up a placement.
+ *  @param key The key of the free counts, job type and k
+ *  @return The entry, NULL if it is not in the cache
+ */
+const PlacementCache::Entry* PlacementCache::Probe(uint64_t key) const {
+    // key 0 marks an empty entry
+    if (key == 0)
+        key = 1;
+    if (entries.empty())
+        return NULL;
+    const Entry & entry = entries[key & (size - 1)];
+    return (entry.key == key) ? &entry : NULL;
+}
+
+/** @brief Save a placement, replacing what was in its slot.
+ *  @param entry The placement
+ */
+void PlacementCache::Store(const Entry & entry) {
+    if (entries.empty()) {
+        Entry empty;
+        empty.key = 0;
+        empty.isPrefered = false;
+        empty.rackNum = 0;
+        entries.assign(size, empty);
+    }
+    uint64_t key = (entry.key == 0) ? 1 : entry.key;
+    Entry & slot = entries[key & (size - 1)];
+    slot = entry;
+    slot.key = key;
+}
+
+/** @brief Remove all placements. */
+void PlacementCache::Clear() {
+    entries.clear();
+}
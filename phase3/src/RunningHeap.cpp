@@ -0,0 +1,142 @@
+/** @file RunningHeap.cpp
+ *  @brief This file contains implementation of the RunningHeap, the running
+ *         jobs ordered by finish time, with removal of any job by its handle.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <algorithm>
+
+/** @brief Put a job at a position and record the position in the job.
+ *  @param job The job
+ *  @param pos The position in the heap
+ */
+void RunningHeap::Place(MyJob* job, size_t pos) {
+    jobs[pos] = job;
+    job->heapIndex = pos;
+}
+
+/** @brief Move a job up while it finishes before its parent.
+ *  @param pos The position of the job
+ */
+void RunningHeap::SiftUp(size_t pos) {
+    MyJob* job = jobs[pos];
+    while (pos > 0) {
+        size_t parent = (pos - 1) / ARITY;
+        // JobComparison(a, b) is true if a finishes after b
+        if (!JobComparison()(jobs[parent], job))
+            break;
+        Place(jobs[parent], pos);
+        pos = parent;
+    }
+    Place(job, pos);
+}
+
+/** @brief Move a job down while a child finishes before it.
+ *  @param pos The position of the job
+ */
+void RunningHeap::SiftDown(size_t pos) {
+    MyJob* job = jobs[pos];
+    while (true) {
+        size_t first = pos * ARITY + 1;
+        if (first >= jobs.size())
+            break;
+
+        size_t best = first;
+        size_t last = std::min(first + ARITY, jobs.size());
+        for (size_t i = first + 1; i < last; i++) {
+            if (JobComparison()(jobs[best], jobs[i]))
+                best = i;
+        }
+
+        if (!JobComparison()(job, jobs[best]))
+            break;
+        Place(jobs[best], pos);
+        pos = best;
+    }
+    Place(job, pos);
+}
+
+/** @brief Add a job.
+ *  @param job The job, not in any heap
+ */
+void RunningHeap::Push(MyJob* job) {
+    jobs.push_back(job);
+    SiftUp(jobs.size() - 1);
+}
+
+/** @brief Get the job that finishes first, the heap must not be empty */
+MyJob* RunningHeap::Top() const {
+    return jobs.front();
+}
+
+/** @brief Remove the job that finishes first, the heap must not be empty.
+ *  @return the removed job
+ */
+MyJob* RunningHeap::Pop() {
+    MyJob* job = jobs.front();
+    Erase(job);
+    return job;
+}
+
+/** @brief Remove a job from wherever it is in the heap.
+ *  @param job The job, it must be in this heap
+ */
+void RunningHeap::Erase(MyJob* job) {
+    size_t pos = job->heapIndex;
+    MyJob* last = jobs.back();
+    jobs.pop_back();
+    job->heapIndex = -1;
+
+    if (pos == jobs.size())
+        return;
+
+    // the last job fills the hole, and moves up or down from there
+    Place(last, pos);
+    if (pos > 0 && JobComparison()(jobs[(pos - 1) / ARITY], last))
+        SiftUp(pos);
+    else
+        SiftDown(pos);
+}
+
+/** @brief Replace the content of the heap.
+ *  @param jobs The jobs, none of them in a heap
+ */
+void RunningHeap::Build(const std::vector<MyJob*> & jobs) {
+    this->jobs = jobs;
+    Rebuild();
+}
+
+/** @brief Restore the heap order after the finish times of the jobs changed. */
+void RunningHeap::Rebuild() {
+    for (size_t i = 0; i < jobs.size(); i++)
+        jobs[i]->heapIndex = i;
+    for (size_t i = jobs.size(); i-- > 0; )
+        SiftDown(i);
+}
+
+/** @brief Check if the heap is empty */
+bool RunningHeap::Empty() const {
+    return jobs.empty();
+}
+
+/** @brief Get the number of jobs in the heap */
+size_t RunningHeap::Size() const {
+    return jobs.size();
+}
+
+/** @brief Get the jobs in heap order, the first one finishes first */
+const std::vector<MyJob*> & RunningHeap::GetJobs() const {
+    return jobs;
+}
+
+/** @brief Remove all jobs, the jobs themselves are not deleted. */
+void RunningHeap::Clear() {
+    for (size_t i = 0; i < jobs.size(); i++)
+        jobs[i]->heapIndex = -1;
+    jobs.clear();
+}
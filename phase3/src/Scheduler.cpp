@@ -0,0 +1,549 @@
+/** @file Scheduler.cpp
+ *  @brief This file contains implementation of the Scheduler, the state and the
+ *         policies of the scheduler server without its RPC transport.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include <fstream>
+#include <string>
+#include <string.h>
+#include "rapidjson/document.h"
+#include <ctime>
+#include <stdio.h>
+#include "inter.h"
+
+
+
+/** @brief Initilize the scheduler, read rack config info 
+ *  @param configFilePath The path of the config file, NULL for the default racks and policy
+ *  @param clock The time of the events, it must outlive the scheduler
+ *  @param allocResources Called with every job started and its machines
+ */
+Scheduler::Scheduler(const char* configFilePath, Clock* clock, 
+                const std::function<void(int, const MachineSet &)> & allocResources) {
+    this->clock = clock;
+    this->allocResources = allocResources;
+    maxMachinesPerRack = 0;
+    tableMemoryMB = 16;
+    searchThreads = 1;
+    searchParams.mode = SEARCH_EXHAUSTIVE;
+    searchParams.beamWidth = 8;
+    searchParams.mctsIterations = 1000;
+    searchParams.durationPerturbStd = 0.1;
+    searchParams.horizon = SEARCH_STEP;
+    searchParams.depth = EXTRA_SEARCH_STEP;
+    searchParams.minDepth = EXTRA_SEARCH_STEP;
+    searchParams.queueLenPerStep = 0;
+    searchParams.timeBudgetMs = 0;
+    searchParams.packing = PACK_GREEDY;
+    searchParams.exactPackStates = 100000;
+    nextPlanStep = 0;
+    reusedPlanSteps = 0;
+    planReuseSteps = 0;
+    
+    std::vector<int> rackInfo;
+    // Read rack info and policy from con/fig file.
+    if (configFilePath != NULL) {
+        rackInfo = ReadConfigFile(configFilePath);
+    }
+    // Using default rack info and policy.
+    else {
+        int rack[4] = {4, 6, 6, 6};
+        rackInfo.assign(&rack[0], &rack[0]+4);
+        policy = soft;
+        maxMachinesPerRack = 6;
+    }
+
+    topology = Topology(rackInfo);
+    for (unsigned int i = 0; i < rackInfo.size(); i++) {
+        std::vector<MyMachine> rack;
+        for(int j = 0; j < rackInfo[i]; j++)
+            rack.push_back(MyMachine(topology.GetMachineID(i, j)));
+        racks.push_back(rack);
+    }
+
+    table = new TranspositionTable((size_t)tableMemoryMB << 20);
+    cluster = NULL;
+
+    pool = NULL;
+    if (searchThreads > 1) {
+        pool = new ThreadPool(searchThreads - 1);
+        dbg_printf("Searching with %d threads\n", searchThreads);
+    }
+}
+
+/** @brief Free the jobs and the search resources of the scheduler. */
+Scheduler::~Scheduler() {
+    while (!pendingJobList.Empty()) {
+        MyJob* job = pendingJobList.Front();
+        pendingJobList.PopFront();
+        delete job;
+    }
+    while (!runningJobList.Empty())
+        delete runningJobList.Pop();
+
+    delete cluster;
+    delete pool;
+    delete table;
+}
+
+/** @brief Read config-mini config file for topology information
+ *  @param configFilePath The path of the config file
+ *  @return A vector which size is the number of racks, each value is the 
+ *          number of machines on each rack 
+ */
+std::vector<int> Scheduler::ReadConfigFile(const char* configFilePath) {
+    std::ifstream t(configFilePath);
+
+    char c;
+    std::string str;
+    while(t.get(c)) {
+        str += c;
+    }
+    const char *cstr = str.c_str();
+    rapidjson::Document d;
+    d.Parse(cstr);
+    
+    // Using a reference for consecutive access is handy and faster.
+    const rapidjson::Value& a = d["rack_cap"]; 
+    
+    std::vector<int> rv;
+    for (rapidjson::SizeType i = 0; i < a.Size(); i++) { 
+        // rapidjson uses SizeType instead of size_t.
+        rv.push_back(a[i].GetInt());
+
+        if (maxMachinesPerRack < a[i].GetInt())
+            maxMachinesPerRack = a[i].GetInt();
+    }
+
+    const rapidjson::Value& b = d["simtype"];
+    if (strcmp(b.GetString(), "none") == 0) {
+        policy = none;
+        dbg_printf("Using none policy\n");
+    } else if (strcmp(b.GetString(), "soft") == 0) {
+        policy = soft;
+        dbg_printf("Using soft policy\n");
+    } else if (strcmp(b.GetString(), "hard") == 0) {
+        policy = hard;
+        dbg_printf("Using hard policy\n");
+    } else if (strcmp(b.GetString(), "beam") == 0) {
+        // soft placement, beam search over the delay decisions
+        policy = beam;
+        searchParams.mode = SEARCH_BEAM;
+        dbg_printf("Using beam policy\n");
+    } else if (strcmp(b.GetString(), "mcts") == 0) {
+        // soft placement, Monte Carlo tree search over sampled durations
+        policy = mcts;
+        searchParams.mode = SEARCH_MCTS;
+        dbg_printf("Using mcts policy\n");
+    } else {
+        policy = soft;
+        dbg_printf("Not specify policy, using soft policy\n");
+    }
+
+    if (d.HasMember("tt_memory_mb")) {
+        tableMemoryMB = d["tt_memory_mb"].GetInt();
+    }
+
+    if (d.HasMember("search_threads")) {
+        searchThreads = d["search_threads"].GetInt();
+    }
+
+    if (d.HasMember("beam_width")) {
+        searchParams.beamWidth = d["beam_width"].GetInt();
+    }
+
+    if (d.HasMember("mcts_iterations")) {
+        searchParams.mctsIterations = d["mcts_iterations"].GetInt();
+    }
+
+    // the simulator perturbs durations by this relative deviation, MCTS samples 
+    // with the same one, or with the default if durations are not perturbed
+    if (d.HasMember("duration_perturb_std") && d["duration_perturb_std"].GetDouble() > 0) {
+        searchParams.durationPerturbStd = d["duration_perturb_std"].GetDouble();
+    }
+
+    if (d.HasMember("search_depth")) {
+        searchParams.depth = d["search_depth"].GetInt();
+        searchParams.minDepth = searchParams.depth;
+    }
+
+    if (d.HasMember("search_min_depth")) {
+        searchParams.minDepth = d["search_min_depth"].GetInt();
+    }
+
+    if (d.HasMember("search_queue_len_per_step")) {
+        searchParams.queueLenPerStep = d["search_queue_len_per_step"].GetInt();
+    }
+
+    if (d.HasMember("search_horizon")) {
+        searchParams.horizon = d["search_horizon"].GetInt();
+    }
+
+    if (d.HasMember("search_time_budget_ms")) {
+        searchParams.timeBudgetMs = d["search_time_budget_ms"].GetInt();
+    }
+
+    if (d.HasMember("packing")) {
+        // "exact" packs the jobs of a search decision by the exact packer
+        searchParams.packing = (strcmp(d["packing"].GetString(), "exact") == 0) ? 
+                                                            PACK_EXACT : PACK_GREEDY;
+    }
+
+    if (d.HasMember("exact_pack_states")) {
+        searchParams.exactPackStates = d["exact_pack_states"].GetInt();
+    }
+
+    if (d.HasMember("replan_reuse_steps")) {
+        planReuseSteps = d["replan_reuse_steps"].GetInt();
+    }
+
+    return rv;
+}
+
+/** @brief Return the machine given its id */
+MyMachine* Scheduler::GetMachineByID(uint32_t id) {
+    return &(racks[topology.GetRack(id)][topology.GetSlot(id)]);
+}
+
+/** @brief Mark a set of machines as allocated
+ *  @param machines The set of machines that will be marked as allocated
+ */
+void Scheduler::AllocateBestMachines(MyJob* job, MachineSet & machines) {
+    for (MachineSet::const_iterator it=machines.begin(); 
+                                                it!=machines.end(); ++it) {
+        GetMachineByID(*it)->AssignJob(job);
+    }
+
+}
+
+/** @brief Get the id of the random free machines,
+ *         For non (random) policy
+ */
+int Scheduler::GetRandomFreeMachine() {
+    int rackIndex, machineIndex;
+    int rackNum = racks.size(), machineNum;
+    while(1) {
+        rackIndex = rand() % rackNum;
+        machineNum = racks[rackIndex].size();
+        machineIndex = rand() % machineNum;
+        if (racks[rackIndex][machineIndex].IsFree()) {
+            return racks[rackIndex][machineIndex].machineID;
+        }
+    }
+    return -1;
+}
+
+/** @brief Get the total number of free machines 
+ *         For non (random) policy  
+ */
+int Scheduler::GetFreeMachinesNum() {
+    int count = 0;
+    for (unsigned int i = 0; i < racks.size(); i++)
+        for (unsigned int j = 0; j < racks[i].size(); j++)
+            if (racks[i][j].IsFree())
+                count++;
+    return count;
+}
+
+/** @brief print current resources allocation information */
+void Scheduler::printRackInfo() {  
+    dbg_printf("=============================================\n");
+    dbg_printf("rack\t");
+    for(int i = 0; i < maxMachinesPerRack; i++)
+        dbg_printf("h%d\t", i);
+    dbg_printf("total\n");
+
+    for (unsigned int i = 0; i < racks.size(); i++) {
+        dbg_printf("r%d\t", i);
+        int num = 0;
+        for (unsigned j = 0; j < racks[i].size(); j++) {
+            int flag = racks[i][j].IsFree() ? 0 : 1;
+            dbg_printf("%d\t", flag);
+            num += (1-flag);
+        }
+        for (unsigned j = racks[i].size(); 
+                                    j < (unsigned)maxMachinesPerRack; j++)
+            dbg_printf("N\t");
+        dbg_printf("%d\n", num);
+    }
+    dbg_printf("=============================================\n");
+}
+
+/** @brief print current queued job information */
+void Scheduler::printJobInfo() {
+    dbg_printf("===================================================================================\n");
+    dbg_printf("Id\tType\tk\tfast\t\tslow\t\tfast utility\tslow utility\n");
+    for (PendingQueue::const_iterator i=pendingJobList.begin(); i != pendingJobList.end(); ++i){
+        dbg_printf("%d\t%d\t%d\t%f\t%f\t%f\t%f\n", (*i)->jobId, (*i)->jobType, 
+                                (*i)->k, (*i)->duration, (*i)->slowDuration, 
+                                (*i)->CalUtility(clock->Now(), true), (*i)->CalUtility(clock->Now(), false));
+    }
+    dbg_printf("==================================================================================\n");
+}
+
+/** @brief Return the pending job given its id */
+MyJob* Scheduler::getPendingJobByID(int jobID) {
+    return pendingJobList.Find(jobID);
+}
+
+/** @brief Schedule 0, 1 or more jobs that are pending, given current free resources */
+void Scheduler::Schedule() {
+    if (policy == none) {
+        // for none policy, just using random FIFO
+        while (!pendingJobList.Empty() && GetFreeMachinesNum() >= pendingJobList.Front()->k) {
+            MyJob* scheduledJob = pendingJobList.Front();
+            pendingJobList.PopFront();
+            
+            int count = scheduledJob->k;
+            MachineSet machines;
+            while (count > 0) {
+                int32_t machineID = GetRandomFreeMachine();
+                GetMachineByID(machineID)->AssignJob(scheduledJob);
+                machines.Insert(machineID);
+                count--;
+            }
+            
+            scheduledJob->Start(machines, false, clock->Now());
+        
+            allocResources(scheduledJob->jobId, machines);
+        
+            runningJobList.Push(scheduledJob);
+        }
+
+        return;
+    }
+
+    // a new decision is made, the last plan is dropped
+    plan.clear();
+    nextPlanStep = 0;
+    reusedPlanSteps = 0;
+
+    // nothing fits in the free machines, so every search decides to start nothing
+    int freeMachineNum = GetFreeMachinesNum();
+    bool anyJobFits = false;
+    for (PendingQueue::const_iterator i=pendingJobList.begin(); 
+                                        i != pendingJobList.end(); ++i) {
+        if ((*i)->k <= freeMachineNum) {
+            anyJobFits = true;
+            break;
+        }
+    }
+    if (!anyJobFits) {
+        dbg_printf("No pending job fits in %d free machines, skip search\n", freeMachineNum);
+        return;
+    }
+
+    // for hard policy and soft policy, create a snapshot of 
+    // the current scheduler and do scheduling. The cluster of the last 
+    // schedule is loaded again, so the memory of its buffers is reused.
+    bool isSoft = (policy == soft || policy == beam || policy == mcts);
+    if (cluster == NULL) {
+        cluster = new Cluster(racks, pendingJobList.GetList(), runningJobList, 
+                                                    &topology, isSoft, &arena);
+        cluster->SetTranspositionTable(table);
+        cluster->SetThreadPool(pool);
+        cluster->SetClock(clock);
+    } else {
+        cluster->Load(racks, pendingJobList.GetList(), runningJobList, isSoft);
+    }
+    cluster->SetSearchParams(searchParams);
+    // The result is a vector where each element represents a schduled job 
+    // with format <jobId, isPrefered, machine0, machine1, machine2, ...>
+    const std::vector<std::vector<int> > & schedule = 
+            cluster->Schedule((planReuseSteps > 0) ? &plan : NULL);
+    
+    ApplySchedule(schedule);
+
+    SearchStats stats = cluster->GetStats();
+    cluster->Clear();
+    arena.Reset();
+
+    dbg_printf("Search: %llu nodes expanded, %llu branches pruned\n", 
+            (unsigned long long)stats.expandedNodes, (unsigned long long)stats.prunedBranches);
+    dbg_printf("Search: depth %d finished%s, plan of %d steps\n", stats.completedDepth, 
+            stats.timedOut ? ", stopped at deadline" : "", (int)plan.size());
+    dbg_printf("Transposition table: %llu hits, %llu misses\n", 
+            (unsigned long long)table->hits, (unsigned long long)table->misses);
+    dbg_printf("Placement cache: %llu hits, %llu misses\n", 
+            (unsigned long long)stats.placementHits, (unsigned long long)stats.placementMisses);
+    dbg_printf("Exact packer: %llu decisions, %llu left to greedy\n", 
+            (unsigned long long)stats.exactPacks, (unsigned long long)stats.exactPackFallbacks);
+    dbg_printf("After schedule\n");
+    printRackInfo();
+    printJobInfo();
+}
+
+/** @brief Start the jobs of a schedule
+ *  @param schedule Each element represents a schduled job with format 
+ *                  <jobId, isPrefered, machine0, machine1, machine2, ...>
+ */
+void Scheduler::ApplySchedule(const std::vector<std::vector<int> > & schedule) {
+    for (unsigned int i = 0; i < schedule.size(); i++) {
+        const std::vector<int> & oneJob = schedule[i];
+        
+        int jobID = oneJob[0];
+        bool isPrefered = (oneJob[1] == 1);
+        
+        MyJob *scheduledJob = getPendingJobByID(jobID);
+        if (scheduledJob == NULL) {
+            dbg_printf("something wrong in Schedule() of sheculer\n");
+        }
+        
+        MachineSet machines; 
+        for (unsigned int j = 2; j < oneJob.size(); j++) {
+            machines.Insert(oneJob[j]);
+        }
+        AllocateBestMachines(scheduledJob, machines);
+        scheduledJob->Start(machines, isPrefered, clock->Now());
+        
+        allocResources(jobID, machines);
+        
+        pendingJobList.Erase(jobID);
+        runningJobList.Push(scheduledJob);
+    }
+}
+
+/** @brief Take the next decision from the last searched plan instead of searching
+ *         again, if the plan expected this job to finish next at this time, and 
+ *         its jobs and machines are still available.
+ *  @param finishedJobId The job that just finished
+ *  @return true if the plan step is applied, false if a new search is needed
+ */
+bool Scheduler::ApplyPlanStep(int finishedJobId) {
+    if (nextPlanStep >= plan.size() || reusedPlanSteps >= planReuseSteps)
+        return false;
+
+    PlanStep & step = plan[nextPlanStep];
+    // the search expected the job to finish at this time, the plan of a job that
+    // finished earlier or later was made for another state of the cluster
+    if (step.finishedJobId != finishedJobId || step.finishTime != clock->Now())
+        return false;
+
+    for (unsigned int i = 0; i < step.decision.size(); i++) {
+        if (getPendingJobByID(step.decision[i][0]) == NULL)
+            return false;
+        for (unsigned int j = 2; j < step.decision[i].size(); j++) {
+            if (!GetMachineByID(step.decision[i][j])->IsFree())
+                return false;
+        }
+    }
+
+    dbg_printf("Job %d finished as planned, start %d jobs from plan step %d\n", 
+            finishedJobId, (int)step.decision.size(), (int)nextPlanStep);
+    ApplySchedule(step.decision);
+    nextPlanStep++;
+    reusedPlanSteps++;
+
+    printRackInfo();
+    printJobInfo();
+    return true;
+}
+
+/** @brief A job is added to scheduler, waiting for allocating resources
+ *  @param jobId The id of the job
+ *  @param jobType The type of the job
+ *  @param k The number of machines that the job is asking
+ *  @param priority The priority of the job
+ *  @param duration The estimated time of the job if on job's 
+ *                  preferred allocation
+ *  @param slowDuration The estimated time of the job if not on job's 
+ *                      preferred allocation
+ */
+void Scheduler::AddJob(const JobID jobId, const job_t::type jobType, const int32_t k, 
+            const int32_t priority, const double duration, 
+            const double slowDuration)
+{   
+    if (duration <= 0 || slowDuration <= 0) {
+        dbg_printf("Parameter check failed, \
+                                        duration should be positive\n");
+    }
+
+    dbg_printf("a new job comming: id:%d, type:%d, k:%d, fast:%f, slow:%f\n", jobId, 
+            jobType, k, duration, slowDuration);
+
+    pendingJobList.PushBack(
+            new MyJob(jobId, jobType, k, duration, slowDuration, clock->Now()));
+
+    // the plan did not know this job, none of its steps is valid anymore
+    plan.clear();
+    
+    Schedule();
+}
+
+/** @brief Free some machine resources
+ *  @param machines The set of machines that will be freed
+ */
+void Scheduler::FreeResources(const std::set<int32_t> & machines)
+{   
+    dbg_printf("free %d machines\n", (int)machines.size());
+
+    std::vector<int> finishedJobs;
+
+    // free machine resource one by one
+    for (std::set<int32_t>::iterator it=machines.begin(); 
+            it!=machines.end(); ++it) {
+        
+        int machineID = *it;
+        
+
+        MyMachine *machine = GetMachineByID(machineID);
+        
+        MyJob *job = machine->belongedJob;
+        
+        machine->Free();
+        
+        job->FreeMachine(machineID);
+        
+        if (job->IsFinished()) {
+            finishedJobs.push_back(job->jobId);
+            runningJobList.Erase(job);
+            dbg_printf("A job %d is finished, real time: %f, expected time: %f\n", 
+                    job->jobId, difftime(clock->Now(), job->startTime), 
+                    job->isPrefered ? job->duration : job->slowDuration);
+            delete job;
+        }
+    }
+
+    // only the finish of the one job the plan expected next keeps the plan valid
+    if (finishedJobs.size() == 1 && ApplyPlanStep(finishedJobs[0]))
+        return;
+
+    Schedule();
+}
+
+/** @brief Change the search parameters at runtime, a negative value (or a 
+ *         depth below 1) keeps the current setting
+ *  @param depth The maximum number of search steps
+ *  @param horizon The number of running jobs to look ahead
+ *  @param timeBudgetMs The wall-clock budget of one decision in ms, 0 for no limit
+ */
+void Scheduler::SetSearchParams(const int32_t depth, const int32_t horizon, 
+            const int32_t timeBudgetMs)
+{
+    if (depth >= 1) {
+        // keep the adaptive range, but not deeper than the new depth
+        searchParams.depth = depth;
+        if (searchParams.minDepth > depth || searchParams.queueLenPerStep <= 0)
+            searchParams.minDepth = depth;
+    }
+    if (horizon >= 0)
+        searchParams.horizon = horizon;
+    if (timeBudgetMs >= 0)
+        searchParams.timeBudgetMs = timeBudgetMs;
+
+    dbg_printf("Search params: depth %d (min %d), horizon %d, time budget %d ms\n", 
+            searchParams.depth, searchParams.minDepth, searchParams.horizon, 
+            searchParams.timeBudgetMs);
+}
+
+/** @brief Get the rack layout of the scheduler.
+ *  @return The topology
+ */
+const Topology & Scheduler::GetTopology() const {
+    return topology;
+}
@@ -0,0 +1,343 @@
+/** @file SchedulerBenchmark.cpp
+ *  @brief This file contains micro-benchmarks of the scheduler hot paths,
+ *         written with Google Benchmark. Build them with "make benchmark",
+ *         preferably with the release flags.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+/** @brief The number of heap allocations of the process, counted by the 
+ *         operator new below. They are not inlined, so the compiler does not
+ *         pair the malloc and free inside them with the new and delete calls.
+ */
+static std::atomic<uint64_t> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+/** @brief The running queue order when the finish time was computed on every
+ *         comparison, kept to compare with JobComparison.
+ */
+struct RecomputedJobComparison {
+    bool operator() (const MyJob* job1, const MyJob* job2) const {
+        int endTime1, endTime2;
+        double duration;
+        duration = job1->isPrefered ? job1->duration : job1->slowDuration;
+        endTime1 = (job1->startTime) + (int)duration;
+     
+        duration = job2->isPrefered ? job2->duration : job2->slowDuration;
+        endTime2 = (job2->startTime) + (int)duration;
+         
+        if (endTime1 != endTime2)
+            return endTime1 > endTime2;
+        return job1->jobId > job2->jobId;
+    }
+};
+
+/** @brief Create started jobs with random durations and start times.
+ *  @param num The number of jobs
+ *  @return the jobs, the caller deletes them
+ */
+static std::vector<MyJob*> MakeRunningJobs(int num) {
+    srand(1);
+    time_t now = time(NULL);
+    std::vector<MyJob*> jobs;
+    for (int i = 0; i < num; i++) {
+        double duration = 39 + rand() % 300;
+        MyJob* job = new MyJob(i, (i % 2) ? job_t::JOB_MPI : job_t::JOB_GPU, 
+                                2 + rand() % 3, duration, duration * 1.5, now);
+        MachineSet machines;
+        job->Start(machines, rand() % 2 == 0, now);
+        job->startTime -= rand() % 600;
+        job->UpdateFinishTime();
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+/** @brief Heapify the running jobs and pop them all, as the search does with
+ *         its running queue.
+ */
+template <class Comparison>
+static void BM_RunningQueueOrder(benchmark::State & state) {
+    std::vector<MyJob*> jobs = MakeRunningJobs(state.range(0));
+    std::vector<MyJob*> heap;
+
+    while (state.KeepRunning()) {
+        heap = jobs;
+        std::make_heap(heap.begin(), heap.end(), Comparison());
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), Comparison());
+            heap.pop_back();
+        }
+        benchmark::DoNotOptimize(heap.data());
+    }
+    state.SetItemsProcessed(state.iterations() * jobs.size());
+
+    for (unsigned int i = 0; i < jobs.size(); i++)
+        delete jobs[i];
+}
+BENCHMARK_TEMPLATE(BM_RunningQueueOrder, RecomputedJobComparison)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_RunningQueueOrder, JobComparison)->Arg(16)->Arg(256)->Arg(4096);
+
+/** @brief The type of the i-th job of a mix, spread evenly over the jobs. At 50 
+ *         percent the jobs are GPU and MPI jobs in turn.
+ *  @param i The index of the job
+ *  @param gpuPercent The share of GPU jobs in percent
+ *  @return The job type
+ */
+static job_t::type JobType(int i, int gpuPercent) {
+    return ((i * gpuPercent) % 100 < gpuPercent) ? job_t::JOB_GPU : job_t::JOB_MPI;
+}
+
+/** @brief The search parameters of the server defaults with another horizon and depth.
+ *  @param horizon The number of running jobs to look ahead
+ *  @param depth The number of search steps
+ *  @return The parameters
+ */
+static SearchParams MakeSearchParams(int horizon, int depth) {
+    SearchParams params;
+    params.mode = SEARCH_EXHAUSTIVE;
+    params.beamWidth = 8;
+    params.mctsIterations = 1000;
+    params.durationPerturbStd = 0.1;
+    params.horizon = horizon;
+    params.depth = depth;
+    params.minDepth = depth;
+    params.queueLenPerStep = 0;
+    params.timeBudgetMs = 0;
+    params.packing = PACK_GREEDY;
+    params.exactPackStates = 100000;
+    return params;
+}
+
+/** @brief Create a cluster state with some jobs running on the first machines 
+ *         and the rest pending.
+ *  @param racks The racks, filled in
+ *  @param pendingJobs The pending jobs, the caller deletes them
+ *  @param runningJobs The running jobs, the caller deletes them
+ *  @param rackNum The number of racks
+ *  @param machinesPerRack The number of machines of every rack
+ *  @param pendingNum The number of pending jobs
+ *  @param runningNum The number of running jobs, at most half the machines
+ *  @param gpuPercent The share of GPU jobs in percent, the others are MPI jobs
+ */
+static void MakeClusterState(std::vector<std::vector<MyMachine> > & racks, 
+                std::list<MyJob*> & pendingJobs, RunningHeap & runningJobs, 
+                int rackNum, int machinesPerRack, int pendingNum, int runningNum,
+                int gpuPercent) {
+    srand(1);
+    time_t now = time(NULL);
+    int id = 0;
+    racks.assign(rackNum, std::vector<MyMachine>());
+    for (unsigned int r = 0; r < racks.size(); r++) {
+        for (int i = 0; i < machinesPerRack; i++)
+            racks[r].push_back(MyMachine(id++));
+    }
+
+    int nextMachine = 0;
+    for (int i = 0; i < runningNum; i++) {
+        double duration = 39 + rand() % 300;
+        MyJob* job = new MyJob(i, JobType(i, gpuPercent), 2, duration, duration * 1.5, now);
+        MachineSet machines;
+        for (int j = 0; j < job->k; j++, nextMachine++) {
+            machines.Insert(nextMachine);
+            racks[nextMachine / machinesPerRack][nextMachine % machinesPerRack].AssignJob(job);
+        }
+        job->Start(machines, true, now);
+        runningJobs.Push(job);
+    }
+
+    for (int i = 0; i < pendingNum; i++) {
+        double duration = 39 + rand() % 300;
+        pendingJobs.push_back(new MyJob(runningNum + i, JobType(i, gpuPercent), 
+                                2 + rand() % 3, duration, duration * 1.5, now - rand() % 300));
+    }
+}
+
+/** @brief Delete the jobs of a cluster state.
+ *  @param pendingJobs The pending jobs
+ *  @param runningJobs The running jobs, cleared
+ */
+static void DeleteClusterState(std::list<MyJob*> & pendingJobs, RunningHeap & runningJobs) {
+    for (std::list<MyJob*>::iterator i = pendingJobs.begin(); i != pendingJobs.end(); ++i)
+        delete *i;
+    pendingJobs.clear();
+    std::vector<MyJob*> jobs = runningJobs.GetJobs();
+    runningJobs.Clear();
+    for (unsigned int i = 0; i < jobs.size(); i++)
+        delete jobs[i];
+}
+
+/** @brief The most heap allocations of a decision on a cluster that is loaded 
+ *         again, once its buffers have grown to the size of the decisions.
+ */
+static const double MAX_RELOADED_ALLOCATIONS = 1;
+
+/** @brief One scheduling decision from a snapshot to the cleared cluster: on a new
+ *         cluster with the jobs on the heap (0) or on an arena (1), or on a cluster 
+ *         loaded again with the jobs on an arena (2), as the server does. Reports 
+ *         the heap allocations and the search nodes of a decision. The reloaded 
+ *         cluster fails if it allocates more than MAX_RELOADED_ALLOCATIONS.
+ */
+static void BM_ScheduleAllocations(benchmark::State & state) {
+    std::vector<std::vector<MyMachine> > racks;
+    std::list<MyJob*> pendingJobs;
+    RunningHeap runningJobs;
+    MakeClusterState(racks, pendingJobs, runningJobs, 4, 6, 10, 4, 50);
+    std::vector<int> rackSizes(racks.size(), 6);
+    Topology topology(rackSizes);
+    Arena arena;
+    SearchParams params = MakeSearchParams(SEARCH_STEP, EXTRA_SEARCH_STEP);
+    bool reload = (state.range(0) == 2);
+
+    // the first decision of the reloaded cluster grows its buffers
+    Cluster* cluster = NULL;
+    if (reload) {
+        cluster = new Cluster(racks, pendingJobs, runningJobs, &topology, true, &arena);
+        cluster->SetSearchParams(params);
+        cluster->Schedule(NULL);
+        cluster->Clear();
+        arena.Reset();
+    }
+
+    uint64_t allocationsBefore = allocations;
+    uint64_t nodes = 0;
+    while (state.KeepRunning()) {
+        if (reload)
+            cluster->Load(racks, pendingJobs, runningJobs, true);
+        else
+            cluster = new Cluster(racks, pendingJobs, runningJobs, &topology, true, 
+                                                    state.range(0) ? &arena : NULL);
+        cluster->SetSearchParams(params);
+        const std::vector<std::vector<int> > & schedule = cluster->Schedule(NULL);
+        benchmark::DoNotOptimize(schedule.data());
+        nodes += cluster->GetStats().expandedNodes;
+        cluster->Clear();
+        if (!reload)
+            delete cluster;
+        arena.Reset();
+    }
+    double allocationsPerDecision = (double)(allocations - allocationsBefore) / state.iterations();
+    state.counters["allocs"] = allocationsPerDecision;
+    state.counters["nodes"] = (double)nodes / state.iterations();
+    if (reload && allocationsPerDecision > MAX_RELOADED_ALLOCATIONS)
+        state.SkipWithError("a reloaded cluster allocates on the heap");
+
+    if (reload)
+        delete cluster;
+    DeleteClusterState(pendingJobs, runningJobs);
+}
+BENCHMARK(BM_ScheduleAllocations)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+/** @brief One greedy decision of a long pending queue on 16 racks of 32 machines,
+ *         from a snapshot to the cleared cluster. The argument is the number of 
+ *         pending jobs.
+ */
+static void BM_GreedyDecision(benchmark::State & state) {
+    std::vector<std::vector<MyMachine> > racks;
+    std::list<MyJob*> pendingJobs;
+    RunningHeap runningJobs;
+    MakeClusterState(racks, pendingJobs, runningJobs, 16, 32, state.range(0), 16, 50);
+    std::vector<int> rackSizes(racks.size(), 32);
+    Topology topology(rackSizes);
+    Arena arena;
+    SearchParams params = MakeSearchParams(1, 1);
+
+    size_t started = 0;
+    while (state.KeepRunning()) {
+        Cluster* cluster = new Cluster(racks, pendingJobs, runningJobs, &topology, true, &arena);
+        cluster->SetSearchParams(params);
+        started = cluster->Schedule(NULL).size();
+        cluster->Clear();
+        delete cluster;
+        arena.Reset();
+    }
+    state.counters["started"] = started;
+
+    DeleteClusterState(pendingJobs, runningJobs);
+}
+BENCHMARK(BM_GreedyDecision)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+/** @brief One scheduling decision as the server makes it, on a cluster loaded 
+ *         again with the jobs on an arena. The time is of the Schedule call only, 
+ *         the Load before it and the Clear after it are not timed. The arguments 
+ *         are the racks, the machines per rack, the pending jobs, the running jobs, 
+ *         the percent of GPU jobs and the search depth. Also reports the heap 
+ *         allocations of the Load, Schedule and Clear of a decision and its search 
+ *         nodes. Each group below varies one argument of 4 racks of 6 machines, 
+ *         20 pending and 4 running jobs, half GPU, depth 3.
+ */
+static void BM_Schedule(benchmark::State & state) {
+    int rackNum = state.range(0);
+    int machinesPerRack = state.range(1);
+    std::vector<std::vector<MyMachine> > racks;
+    std::list<MyJob*> pendingJobs;
+    RunningHeap runningJobs;
+    MakeClusterState(racks, pendingJobs, runningJobs, rackNum, machinesPerRack, 
+                                state.range(2), state.range(3), state.range(4));
+    std::vector<int> rackSizes(rackNum, machinesPerRack);
+    Topology topology(rackSizes);
+    Arena arena;
+    SearchParams params = MakeSearchParams(SEARCH_STEP, state.range(5));
+
+    // the first decision grows the buffers of the cluster
+    Cluster* cluster = new Cluster(racks, pendingJobs, runningJobs, &topology, true, &arena);
+    cluster->SetSearchParams(params);
+    cluster->Schedule(NULL);
+    cluster->Clear();
+    arena.Reset();
+
+    uint64_t allocationsBefore = allocations;
+    uint64_t nodes = 0;
+    while (state.KeepRunning()) {
+        cluster->Load(racks, pendingJobs, runningJobs, true);
+        cluster->SetSearchParams(params);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const std::vector<std::vector<int> > & schedule = cluster->Schedule(NULL);
+        benchmark::DoNotOptimize(schedule.data());
+        state.SetIterationTime(std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start).count());
+        nodes += cluster->GetStats().expandedNodes;
+        cluster->Clear();
+        arena.Reset();
+    }
+    state.counters["allocs"] = (double)(allocations - allocationsBefore) / state.iterations();
+    state.counters["nodes"] = (double)nodes / state.iterations();
+
+    delete cluster;
+    DeleteClusterState(pendingJobs, runningJobs);
+}
+BENCHMARK(BM_Schedule)->UseManualTime()
+    ->ArgNames({"racks", "machines", "pending", "running", "gpu", "depth"})
+    // cluster size
+    ->Args({4, 6, 20, 4, 50, 3})->Args({8, 16, 20, 4, 50, 3})->Args({16, 32, 20, 4, 50, 3})
+    // queue length
+    ->Args({4, 6, 5, 4, 50, 3})->Args({4, 6, 100, 4, 50, 3})->Args({4, 6, 1000, 4, 50, 3})
+    // running jobs
+    ->Args({4, 6, 20, 0, 50, 3})->Args({4, 6, 20, 8, 50, 3})->Args({4, 6, 20, 12, 50, 3})
+    // job type mix
+    ->Args({4, 6, 20, 4, 0, 3})->Args({4, 6, 20, 4, 100, 3})
+    // search depth
+    ->Args({4, 6, 20, 4, 50, 1})->Args({4, 6, 20, 4, 50, 5})->Args({4, 6, 20, 4, 50, 7});
+
+BENCHMARK_MAIN();
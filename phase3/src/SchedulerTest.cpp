@@ -0,0 +1,213 @@
+/** @file SchedulerTest.cpp
+ *  @brief This file contains checks of the scheduler search, build and run them
+ *         with "make test".
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** @brief Create a cluster state where many jobs tie: the pending jobs share a few
+ *         shapes, durations and arrive times, the running jobs a few finish times.
+ *         Some running jobs are overdue, so the next decision is made now, and a 
+ *         delayed job loses no utility. The durations are fractional, so the sums
+ *         of utilities depend on the order they are added in.
+ *  @param seed The seed of the state
+ *  @param now The current time
+ *  @param racks The racks, filled in
+ *  @param pendingJobs The pending jobs, the caller deletes them
+ *  @param runningJobs The running jobs, the caller deletes them
+ */
+static void MakeTieState(unsigned int seed, time_t now,
+                std::vector<std::vector<MyMachine> > & racks,
+                std::list<MyJob*> & pendingJobs, RunningHeap & runningJobs) {
+    srand(seed);
+    int machinesPerRack = 6;
+    int id = 0;
+    racks.assign(4, std::vector<MyMachine>());
+    for (unsigned int r = 0; r < racks.size(); r++) {
+        for (int i = 0; i < machinesPerRack; i++)
+            racks[r].push_back(MyMachine(id++));
+    }
+
+    int jobId = 0;
+    int runningNum = 2 + rand() % 4;
+    for (int i = 0; i < runningNum; i++) {
+        double duration = 100 * (1 + rand() % 2);
+        MyJob* job = new MyJob(jobId++, (rand() % 2) ? job_t::JOB_MPI : job_t::JOB_GPU,
+                                2, duration, duration * 2, now);
+        MachineSet machines;
+        // two machines of a random rack with both free
+        for (int tries = 0; tries < 16 && machines.Size() == 0; tries++) {
+            int r = rand() % racks.size();
+            int slot = 2 * (rand() % (machinesPerRack / 2));
+            if (racks[r][slot].IsFree() && racks[r][slot + 1].IsFree()) {
+                for (int j = slot; j < slot + 2; j++) {
+                    machines.Insert(racks[r][j].machineID);
+                    racks[r][j].AssignJob(job);
+                }
+            }
+        }
+        if (machines.Size() == 0) {
+            delete job;
+            continue;
+        }
+        job->Start(machines, true, now - 50 * (rand() % 5));
+        runningJobs.Push(job);
+    }
+
+    int pendingNum = 4 + rand() % 8;
+    for (int i = 0; i < pendingNum; i++) {
+        double duration = 50 * (1 + rand() % 3) + 0.1 * (rand() % 10);
+        pendingJobs.push_back(new MyJob(jobId++, (rand() % 2) ? job_t::JOB_MPI : job_t::JOB_GPU,
+                                2 + rand() % 3, duration, duration * 1.7, now - 30 * (rand() % 3)));
+    }
+}
+
+/** @brief Delete the jobs of a cluster state.
+ *  @param pendingJobs The pending jobs
+ *  @param runningJobs The running jobs, cleared
+ */
+static void DeleteState(std::list<MyJob*> & pendingJobs, RunningHeap & runningJobs) {
+    for (std::list<MyJob*>::iterator i = pendingJobs.begin(); i != pendingJobs.end(); ++i)
+        delete *i;
+    pendingJobs.clear();
+    std::vector<MyJob*> jobs = runningJobs.GetJobs();
+    runningJobs.Clear();
+    for (unsigned int i = 0; i < jobs.size(); i++)
+        delete jobs[i];
+}
+
+/** @brief Make one decision of a cluster state.
+ *  @param pool The pool, NULL to search on this thread only
+ *  @return The decision
+ */
+static std::vector<std::vector<int> > Decide(std::vector<std::vector<MyMachine> > & racks,
+                std::list<MyJob*> & pendingJobs, RunningHeap & runningJobs,
+                const Topology* topology, bool isSoft, Clock* clock,
+                const SearchParams & params, ThreadPool* pool) {
+    Cluster cluster(racks, pendingJobs, runningJobs, topology, isSoft, NULL);
+    cluster.SetClock(clock);
+    cluster.SetThreadPool(pool);
+    cluster.SetSearchParams(params);
+    std::vector<std::vector<int> > decision = cluster.Schedule(NULL);
+    cluster.Clear();
+    return decision;
+}
+
+/** @brief The search on the thread pool makes the same decision as the search on
+ *         one thread, also when branches tie.
+ *  @return The number of states with a different decision
+ */
+static int TestParallelSearchMatchesSerial() {
+    ThreadPool pool(3);
+    VirtualClock clock(1000000);
+    SearchParams params;
+    params.mode = SEARCH_EXHAUSTIVE;
+    params.beamWidth = 8;
+    params.mctsIterations = 1000;
+    params.durationPerturbStd = 0.1;
+    params.horizon = SEARCH_STEP;
+    params.depth = 4;
+    params.minDepth = 4;
+    params.queueLenPerStep = 0;
+    params.timeBudgetMs = 0;
+    params.packing = PACK_GREEDY;
+    params.exactPackStates = 100000;
+
+    std::vector<int> rackSizes(4, 6);
+    Topology topology(rackSizes);
+    int failures = 0;
+    for (unsigned int seed = 0; seed < 300; seed++) {
+        std::vector<std::vector<MyMachine> > racks;
+        std::list<MyJob*> pendingJobs;
+        RunningHeap runningJobs;
+        MakeTieState(seed, clock.Now(), racks, pendingJobs, runningJobs);
+        bool isSoft = (seed % 2 == 0);
+        params.packing = (seed % 3 == 0) ? PACK_EXACT : PACK_GREEDY;
+
+        std::vector<std::vector<int> > serial = Decide(racks, pendingJobs, runningJobs,
+                                            &topology, isSoft, &clock, params, NULL);
+        std::vector<std::vector<int> > parallel = Decide(racks, pendingJobs, runningJobs,
+                                            &topology, isSoft, &clock, params, &pool);
+        if (serial != parallel) {
+            printf("FAIL parallel search, seed %u: %d jobs started on one thread, %d on the pool\n",
+                                        seed, (int)serial.size(), (int)parallel.size());
+            failures++;
+        }
+        DeleteState(pendingJobs, runningJobs);
+    }
+    return failures;
+}
+
+/** @brief Jobs of a type the cluster has no placement for are never started, by
+ *         any packing or policy, and every started job gets its k machines.
+ *  @return The number of decisions that start such a job or a job without machines
+ */
+static int TestUnplacedTypesStayPending() {
+    VirtualClock clock(1000000);
+    SearchParams params;
+    params.mode = SEARCH_EXHAUSTIVE;
+    params.beamWidth = 8;
+    params.mctsIterations = 1000;
+    params.durationPerturbStd = 0.1;
+    params.horizon = SEARCH_STEP;
+    params.depth = 4;
+    params.minDepth = 4;
+    params.queueLenPerStep = 0;
+    params.timeBudgetMs = 0;
+    params.packing = PACK_GREEDY;
+    params.exactPackStates = 100000;
+
+    std::vector<int> rackSizes(4, 6);
+    Topology topology(rackSizes);
+    int failures = 0;
+    for (unsigned int seed = 0; seed < 40; seed++) {
+        std::vector<std::vector<MyMachine> > racks;
+        std::list<MyJob*> pendingJobs;
+        RunningHeap runningJobs;
+        MakeTieState(seed, clock.Now(), racks, pendingJobs, runningJobs);
+        // the new jobs have the smallest utility loss, a search would start them first
+        std::set<int> unplacedJobs;
+        for (int i = 0; i < 3; i++) {
+            int jobId = 1000 + i;
+            pendingJobs.push_back(new MyJob(jobId, (i % 2) ? job_t::JOB_HDFS : job_t::JOB_WEB,
+                                                    2, 10, 10, clock.Now()));
+            unplacedJobs.insert(jobId);
+        }
+        bool isSoft = (seed % 2 == 0);
+        params.packing = (seed % 4 < 2) ? PACK_EXACT : PACK_GREEDY;
+
+        std::vector<std::vector<int> > decision = Decide(racks, pendingJobs, runningJobs,
+                                            &topology, isSoft, &clock, params, NULL);
+        for (unsigned int i = 0; i < decision.size(); i++) {
+            if (unplacedJobs.count(decision[i][0]) > 0 || decision[i].size() <= 2) {
+                printf("FAIL unplaced types, seed %u: job %d started on %d machines\n",
+                                        seed, decision[i][0], (int)decision[i].size() - 2);
+                failures++;
+                break;
+            }
+        }
+        DeleteState(pendingJobs, runningJobs);
+    }
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    failures += TestParallelSearchMatchesSerial();
+    failures += TestUnplacedTypesStayPending();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,349 @@
+/** @file Simulator.cpp
+ *  @brief This file contains implementation of an offline simulator, it replays
+ *         traces through the scheduler on a virtual clock, without YARN.
+ *
+ *         Usage: schedsim -c config -o result [-s startEpoch] [-r seed] trace...
+ *
+ *         A trace line is "arrival,arrival,arrival+duration,k,priority", the
+ *         job type is the jobtype of the trace in the config file, by the name
+ *         in "trace<Name>-...", or the sixth column of a combined trace. Only
+ *         MPI and GPU jobs are replayed, the scheduler places no others. The
+ *         result has one line per finished job in the layout of the .result
+ *         files, times in ms from startEpoch, rack r0 is the host of the AM.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include "rapidjson/document.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "inter.h"
+
+/** @brief A job of the traces and what happened to it */
+struct SimJob {
+    job_t::type jobType;
+    int k;
+    int priority;
+    double duration;
+    double slowDuration;
+    double arriveTime;
+    double startTime;
+    double finishTime;
+    std::vector<int32_t> machines;
+};
+
+/** @brief The kinds of events, a finish goes before an arrival at the same time */
+enum SimEventType {
+    EVENT_FINISH = 0,
+    EVENT_ARRIVE = 1
+};
+
+/** @brief An arrival or a finish of a job */
+struct SimEvent {
+    double time;
+    SimEventType type;
+    int jobId;
+
+    /** @brief The order of the event queue, the earliest event on top */
+    bool operator< (const SimEvent & event) const {
+        if (time != event.time)
+            return time > event.time;
+        if (type != event.type)
+            return type > event.type;
+        return jobId > event.jobId;
+    }
+};
+
+/** @brief Read a whole file
+ *  @param path The path of the file
+ *  @param content The content, this is also a return value
+ *  @return false if the file can not be read
+ */
+static bool ReadFile(const char* path, std::string & content) {
+    std::ifstream t(path);
+    if (!t)
+        return false;
+
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+    content = buffer.str();
+    return true;
+}
+
+/** @brief Find the type of the jobs of a trace from its file name
+ *  @param config The config file
+ *  @param path The path of the trace, named "trace<Name>-..."
+ *  @param jobType The job type, this is also a return value
+ *  @return false if the config has no trace of this name
+ */
+static bool GetTraceType(const rapidjson::Document & config, const char* path, int & jobType) {
+    const char* name = strrchr(path, '/');
+    name = (name == NULL) ? path : name + 1;
+    if (strncmp(name, "trace", 5) != 0 || !config.HasMember("traces"))
+        return false;
+
+    std::string traceName(name + 5);
+    traceName = traceName.substr(0, traceName.find('-'));
+    const rapidjson::Value & traces = config["traces"];
+    if (!traces.HasMember(traceName.c_str()))
+        return false;
+
+    jobType = traces[traceName.c_str()]["jobtype"].GetInt();
+    return true;
+}
+
+/** @brief Find the duration of a job not on its preferred machines, the measured
+ *         one of the config if the job is listed there, else the duration
+ *         times the slowdown of the trace of its job type in the config
+ *  @param config The config file
+ *  @param job The job, its duration is set to the listed one if it is found
+ *  @return The slow duration
+ */
+static double GetSlowDuration(const rapidjson::Document & config, SimJob & job) {
+    if (!config.HasMember("traces"))
+        return job.duration;
+
+    double slowdown = 1;
+    const rapidjson::Value & traces = config["traces"];
+    for (rapidjson::Value::ConstMemberIterator i = traces.MemberBegin();
+                                                i != traces.MemberEnd(); ++i) {
+        const rapidjson::Value & trace = i->value;
+        if (!trace.HasMember("jobtype") || trace["jobtype"].GetInt() != job.jobType)
+            continue;
+        if (trace.HasMember("slowdown"))
+            slowdown = trace["slowdown"].GetDouble();
+
+        // GPU jobs are listed by duration, MPI jobs by duration and k
+        const char* listName = trace.HasMember("durationKList") ? "durationKList" :
+                                                                "durationList";
+        if (!trace.HasMember(listName))
+            continue;
+        const rapidjson::Value & list = trace[listName];
+        for (rapidjson::SizeType j = 0; j < list.Size(); j++) {
+            double duration = list[j]["duration"].GetDouble();
+            if (fabs(duration - job.duration) >= 0.5)
+                continue;
+            if (list[j].HasMember("k") && list[j]["k"].GetInt() != job.k)
+                continue;
+            job.duration = duration;
+            return list[j]["slowduration"].GetDouble();
+        }
+    }
+    return job.duration * slowdown;
+}
+
+/** @brief Read the jobs of a trace. The scheduler only places MPI and GPU jobs, 
+ *         the jobs of other types are skipped.
+ *  @param config The config file
+ *  @param path The path of the trace
+ *  @param jobs The jobs, the jobs of the trace are appended
+ *  @return false if the trace can not be read or its job type is unknown
+ */
+static bool ReadTrace(const rapidjson::Document & config, const char* path,
+                                                        std::vector<SimJob> & jobs) {
+    std::ifstream trace(path);
+    if (!trace) {
+        fprintf(stderr, "Can not read trace %s\n", path);
+        return false;
+    }
+
+    int traceType = -1;
+    GetTraceType(config, path, traceType);
+
+    int skippedJobs = 0;
+    std::string line;
+    while (std::getline(trace, line)) {
+        double arrival, submit, end;
+        int k, priority, jobType = traceType;
+        int columns = sscanf(line.c_str(), "%lf,%lf,%lf,%d,%d,%d",
+                                    &arrival, &submit, &end, &k, &priority, &jobType);
+        if (columns < 5)
+            continue;
+        if (jobType < 0) {
+            fprintf(stderr, "Unknown job type of trace %s\n", path);
+            return false;
+        }
+        if ((jobType != job_t::JOB_MPI && jobType != job_t::JOB_GPU) || k <= 0) {
+            skippedJobs++;
+            continue;
+        }
+
+        SimJob job;
+        job.jobType = (job_t::type)jobType;
+        job.k = k;
+        job.priority = priority;
+        job.duration = end - arrival;
+        job.slowDuration = GetSlowDuration(config, job);
+        job.arriveTime = arrival;
+        job.startTime = -1;
+        job.finishTime = -1;
+        jobs.push_back(job);
+    }
+    if (skippedJobs > 0)
+        fprintf(stderr, "Skipped %d jobs of trace %s, only MPI and GPU jobs are placed\n",
+                                                                    skippedJobs, path);
+    return true;
+}
+
+/** @brief Check whether a job got its preferred machines, GPU jobs prefer the
+ *         GPU rack and MPI jobs one rack, as the scheduler places them.
+ *  @param job The job
+ *  @param topology The racks of the scheduler
+ *  @return true if on job's preferred allocation, else false
+ */
+static bool IsPreferedPlacement(const SimJob & job, const Topology & topology) {
+    if (job.machines.empty())
+        return false;
+    int firstRack = topology.GetRack(job.machines[0]);
+    for (unsigned int i = 0; i < job.machines.size(); i++) {
+        int rack = topology.GetRack(job.machines[i]);
+        if (rack != firstRack || (job.jobType == job_t::JOB_GPU && rack != 0))
+            return false;
+    }
+    return job.jobType == job_t::JOB_MPI || job.jobType == job_t::JOB_GPU;
+}
+
+/** @brief Write the result line of a finished job
+ *  @param out The result file
+ *  @param job The job
+ *  @param jobId The id of the job, the sequence number of its application
+ *  @param startEpoch The time of the start of the traces in seconds
+ *  @param topology The racks of the scheduler
+ */
+static void WriteResult(FILE* out, const SimJob & job, int jobId, time_t startEpoch,
+                                                            const Topology & topology) {
+    long long startMs = (long long)startEpoch * 1000;
+    fprintf(out, "%d-%d-%d-%.1f-%g,%lld,%lld,%lld,%lld,FINISHED,r0h0/10.10.1.10,r0h0:0",
+            job.jobType, job.k, job.priority, job.duration, job.slowDuration,
+            startMs + llround(job.arriveTime * 1000), startMs + llround(job.arriveTime * 1000),
+            startMs + llround(job.startTime * 1000), startMs + llround(job.finishTime * 1000));
+    for (unsigned int i = 0; i < job.machines.size(); i++) {
+        fprintf(out, "|r%dh%d:0", topology.GetRack(job.machines[i]) + 1,
+                                            topology.GetSlot(job.machines[i]));
+    }
+    fprintf(out, ",application_%lld_%04d\n", startMs, jobId);
+}
+
+int main(int argc, char **argv)
+{
+    const char* configFilePath = NULL;
+    const char* outputPath = NULL;
+    time_t startEpoch = 0;
+    unsigned int seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:o:s:r:")) != -1) {
+        switch (opt) {
+            case 'c':
+                configFilePath = optarg;
+                break;
+            case 'o':
+                outputPath = optarg;
+                break;
+            case 's':
+                startEpoch = (time_t)atoll(optarg);
+                break;
+            case 'r':
+                seed = (unsigned int)atoi(optarg);
+                break;
+            default:
+                break;
+        }
+    }
+    if (configFilePath == NULL || outputPath == NULL || optind >= argc) {
+        fprintf(stderr, "Usage: %s -c config -o result [-s startEpoch] [-r seed] trace...\n",
+                                                                                argv[0]);
+        return 1;
+    }
+
+    std::string configText;
+    if (!ReadFile(configFilePath, configText)) {
+        fprintf(stderr, "Can not read config file %s\n", configFilePath);
+        return 1;
+    }
+    rapidjson::Document config;
+    config.Parse(configText.c_str());
+
+    std::vector<SimJob> jobs;
+    for (int i = optind; i < argc; i++) {
+        if (!ReadTrace(config, argv[i], jobs))
+            return 1;
+    }
+
+    FILE* out = fopen(outputPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Can not write result file %s\n", outputPath);
+        return 1;
+    }
+
+    // the actual durations differ from the expected ones by this relative deviation
+    double perturbMean = config.HasMember("duration_perturb_mean") ?
+                                    config["duration_perturb_mean"].GetDouble() : 0;
+    double perturbStd = config.HasMember("duration_perturb_std") ?
+                                    config["duration_perturb_std"].GetDouble() : 0;
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> perturb(1 + perturbMean, perturbStd > 0 ? perturbStd : 1);
+    // the none policy places jobs on random machines
+    srand(seed);
+
+    std::priority_queue<SimEvent> events;
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        SimEvent event = {jobs[i].arriveTime, EVENT_ARRIVE, (int)i};
+        events.push(event);
+    }
+
+    VirtualClock clock(startEpoch);
+    double curTime = 0;
+    Scheduler* scheduler = NULL;
+    std::function<void(int, const MachineSet &)> allocResources =
+                                        [&](int jobId, const MachineSet & machines) {
+        SimJob & job = jobs[jobId];
+        job.startTime = curTime;
+        job.machines.clear();
+        for (MachineSet::const_iterator it=machines.begin(); it!=machines.end(); ++it)
+            job.machines.push_back(*it);
+
+        double duration = IsPreferedPlacement(job, scheduler->GetTopology()) ?
+                                                    job.duration : job.slowDuration;
+        if (perturbStd > 0)
+            duration *= std::max(perturb(rng), MCTS_MIN_DURATION_FACTOR);
+        SimEvent event = {curTime + duration, EVENT_FINISH, jobId};
+        events.push(event);
+    };
+    scheduler = new Scheduler(configFilePath, &clock, allocResources);
+
+    int finishedJobs = 0;
+    while (!events.empty()) {
+        SimEvent event = events.top();
+        events.pop();
+        curTime = event.time;
+        clock.Set(startEpoch + (time_t)curTime);
+
+        SimJob & job = jobs[event.jobId];
+        if (event.type == EVENT_ARRIVE) {
+            scheduler->AddJob(event.jobId, job.jobType, job.k, job.priority,
+                                                    job.duration, job.slowDuration);
+        } else {
+            job.finishTime = curTime;
+            WriteResult(out, job, event.jobId + 1, startEpoch, scheduler->GetTopology());
+            finishedJobs++;
+            scheduler->FreeResources(std::set<int32_t>(job.machines.begin(), job.machines.end()));
+        }
+    }
+
+    fclose(out);
+    delete scheduler;
+    printf("Simulated %d jobs, %d finished\n", (int)jobs.size(), finishedJobs);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/** @file ThreadPool.cpp
+ *  @brief This file contains implementation of a work-stealing thread pool,
+ *         which runs the independent branches of the N-step search.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Constructor. Start the worker threads.
+ *  @param threadNum The number of worker threads
+ */
+ThreadPool::ThreadPool(int threadNum) {
+    pendingTasks = 0;
+    queuedTasks = 0;
+    nextWorker = 0;
+    stopping = false;
+
+    for (int i = 0; i < threadNum; i++)
+        workers.push_back(new Worker());
+    for (int i = 0; i < threadNum; i++)
+        threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+/** @brief Destructor. Finish the queued tasks and stop the worker threads. */
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(stateLock);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    for (unsigned int i = 0; i < threads.size(); i++)
+        threads[i].join();
+    for (unsigned int i = 0; i < workers.size(); i++)
+        delete workers[i];
+}
+
+/** @brief Get the number of worker threads */
+int ThreadPool::Size() {
+    return workers.size();
+}
+
+/** @brief Queue a task, the workers take turns to receive them.
+ *  @param task The task to run
+ */
+void ThreadPool::Submit(const std::function<void()> & task) {
+    Worker* worker = workers[nextWorker++ % workers.size()];
+    {
+        std::unique_lock<std::mutex> lock(worker->lock);
+        worker->tasks.push_back(task);
+    }
+    {
+        std::unique_lock<std::mutex> lock(stateLock);
+        pendingTasks++;
+        queuedTasks++;
+    }
+    wakeup.notify_one();
+}
+
+/** @brief Run the tasks on the calling thread too, until all submitted tasks finish. */
+void ThreadPool::Wait() {
+    while (true) {
+        if (RunOne(-1))
+            continue;
+
+        std::unique_lock<std::mutex> lock(stateLock);
+        while (pendingTasks > 0 && queuedTasks == 0)
+            done.wait(lock);
+        if (pendingTasks == 0)
+            return;
+    }
+}
+
+/** @brief Run one task: the newest one of the own queue, or else the oldest 
+ *         one stolen from another worker.
+ *  @param self The index of the calling worker, -1 if it is not a worker
+ *  @return true if a task was run, false if all queues are empty
+ */
+bool ThreadPool::RunOne(int self) {
+    std::function<void()> task;
+    bool found = false;
+
+    if (self >= 0) {
+        Worker* worker = workers[self];
+        std::unique_lock<std::mutex> lock(worker->lock);
+        if (!worker->tasks.empty()) {
+            task = worker->tasks.back();
+            worker->tasks.pop_back();
+            found = true;
+        }
+    }
+
+    for (unsigned int i = 1; !found && i <= workers.size(); i++) {
+        Worker* victim = workers[(self + i) % workers.size()];
+        std::unique_lock<std::mutex> lock(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    {
+        std::unique_lock<std::mutex> lock(stateLock);
+        queuedTasks--;
+    }
+
+    task();
+
+    std::unique_lock<std::mutex> lock(stateLock);
+    if (--pendingTasks == 0)
+        done.notify_all();
+    return true;
+}
+
+/** @brief The loop of a worker thread.
+ *  @param index The index of the worker
+ */
+void ThreadPool::WorkerLoop(int index) {
+    while (true) {
+        if (RunOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(stateLock);
+        while (!stopping && queuedTasks == 0)
+            wakeup.wait(lock);
+        if (stopping && queuedTasks == 0)
+            return;
+    }
+}
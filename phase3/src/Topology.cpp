@@ -0,0 +1,73 @@
+/** @file Topology.cpp
+ *  @brief This file contains implementation of the Topology, the index from 
+ *         a machine id to its rack and its slot in the rack.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Constructor of an empty topology. */
+Topology::Topology() {
+    rackOffsets.push_back(0);
+    maxMachinesPerRack = 0;
+}
+
+/** @brief Constructor. Machine ids are numbered rack by rack from 0.
+ *  @param rackSizes The number of machines of every rack
+ */
+Topology::Topology(const std::vector<int> & rackSizes) {
+    rackOffsets.push_back(0);
+    maxMachinesPerRack = 0;
+
+    for (unsigned int i = 0; i < rackSizes.size(); i++) {
+        rackOffsets.push_back(rackOffsets.back() + rackSizes[i]);
+        machineRacks.insert(machineRacks.end(), rackSizes[i], i);
+
+        if (maxMachinesPerRack < rackSizes[i])
+            maxMachinesPerRack = rackSizes[i];
+    }
+}
+
+/** @brief Get the number of racks */
+int Topology::GetRackNum() const {
+    return rackOffsets.size() - 1;
+}
+
+/** @brief Get the number of machines in all racks */
+int Topology::GetMachineNum() const {
+    return rackOffsets.back();
+}
+
+/** @brief Get the max number of machines on the same rack */
+int Topology::GetMaxMachinesPerRack() const {
+    return maxMachinesPerRack;
+}
+
+/** @brief Get the rack of a machine.
+ *  @param id the machine id
+ *  @return the rack index
+ */
+int Topology::GetRack(int id) const {
+    return machineRacks[id];
+}
+
+/** @brief Get the slot of a machine in its rack.
+ *  @param id the machine id
+ *  @return the index of the machine in the rack
+ */
+int Topology::GetSlot(int id) const {
+    return id - rackOffsets[machineRacks[id]];
+}
+
+/** @brief Get the id of a machine from its rack and slot.
+ *  @param rack the rack index
+ *  @param slot the index of the machine in the rack
+ *  @return the machine id
+ */
+int Topology::GetMachineID(int rack, int slot) const {
+    return rackOffsets[rack] + slot;
+}
@@ -0,0 +1,86 @@
+/** @file TranspositionTable.cpp
+ *  @brief This file contains implementation of the TranspositionTable, which 
+ *         caches the utility of cluster states reached by the N-step search.
+ *         It can be shared by the threads of the search.
+ *
+ *  @author Ke Wu <kewu@andrew.cmu.edu>
+ *  @author Linquan Chen <linquanc@andrew.cmu.edu>
+ *
+ *  @bug No known bugs.
+ */
+
+#include "inter.h"
+
+/** @brief Constructor.
+ *  @param memoryBudget The maximum number of bytes used by the entries
+ */
+TranspositionTable::TranspositionTable(size_t memoryBudget) {
+    size_t size = 1;
+    while (size * 2 * sizeof(Entry) <= memoryBudget)
+        size *= 2;
+
+    Entry empty = {0, 0};
+    entries.assign(size, empty);
+    mask = size - 1;
+    hits = misses = 0;
+}
+
+/** @brief Get the Zobrist key of one part of a state.
+ *  @param kind What the part is (machine owner, pending job, running job...)
+ *  @param a The first value of the part
+ *  @param b The second value of the part
+ *  @return a pseudo random 64-bit key, always the same for the same input
+ */
+uint64_t TranspositionTable::HashKey(uint64_t kind, uint64_t a, uint64_t b) {
+    // splitmix64 finalizer over the packed input
+    uint64_t x = kind * 0x9E3779B97F4A7C15ULL + a;
+    x = x * 0xBF58476D1CE4E5B9ULL + b;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/** @brief Look up a state.
+ *  @param key The key of the state
+ *  @param utility The cached utility, only set on a hit
+ *  @return true if the state is in the table, else false
+ */
+bool TranspositionTable::Probe(uint64_t key, double & utility) {
+    // key 0 marks an empty entry
+    if (key == 0)
+        key = 1;
+    uint64_t index = key & mask;
+    std::unique_lock<std::mutex> lock(locks[index % LOCK_NUM]);
+    Entry & entry = entries[index];
+    if (entry.key == key) {
+        utility = entry.utility;
+        hits++;
+        return true;
+    }
+    misses++;
+    return false;
+}
+
+/** @brief Save the utility of a state, replacing what was in its slot.
+ *  @param key The key of the state
+ *  @param utility The best utility from the state
+ */
+void TranspositionTable::Store(uint64_t key, double utility) {
+    if (key == 0)
+        key = 1;
+    uint64_t index = key & mask;
+    std::unique_lock<std::mutex> lock(locks[index % LOCK_NUM]);
+    Entry & entry = entries[index];
+    entry.key = key;
+    entry.utility = utility;
+}
+
+/** @brief Remove all states and reset the counters. */
+void TranspositionTable::Clear() {
+    Entry empty = {0, 0};
+    entries.assign(entries.size(), empty);
+    hits = misses = 0;
+}
@@ -23,8 +23,17 @@
 #include <list>
 #include <set>
 #include <vector>
+#include <string>
+#include <deque>
+#include <unordered_map>
 #include <stdint.h>
 #include <ctime>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace::apache::thrift;
 using namespace::apache::thrift::protocol;
@@ -42,11 +51,195 @@ using boost::shared_ptr;
 # define dbg_printf(...)
 #endif
 
+/* Default search horizon (running jobs to look ahead) and depth (search steps) */
 #define SEARCH_STEP  5
 #define EXTRA_SEARCH_STEP 7
 
+/* UCT exploration constant of the MCTS mode, for utilities scaled to [0, 1] */
+#define MCTS_EXPLORATION 0.7
+
+/* The smallest sampled duration of a job, relative to the expected one */
+#define MCTS_MIN_DURATION_FACTOR 0.1
+
+/* The number of placements cached by every cluster, a power of 2 */
+#define PLACEMENT_CACHE_SIZE 1024
+
 class MyMachine;
 
+/** @brief A monotonic buffer for the objects of one scheduling decision. The
+ *         memory is handed out in order and only given back all at once by
+ *         Reset, which keeps the blocks for the next decision.
+ */
+class Arena {
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    /** @brief The blocks, the ones after the current one are free */
+    std::vector<char*> blocks;
+
+    /** @brief The size of every block */
+    std::vector<size_t> blockSizes;
+
+    /** @brief The block in use */
+    size_t current;
+
+    /** @brief The first unused byte of the block in use */
+    size_t offset;
+
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+
+public:
+    Arena();
+
+    ~Arena();
+
+    void* Allocate(size_t size, size_t align);
+
+    void Reset();
+
+    size_t GetReservedBytes() const;
+};
+
+/** @brief A standard allocator on an arena, deallocate does nothing. With no
+ *         arena it allocates from the heap.
+ */
+template <class T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    Arena* arena;
+
+    ArenaAllocator() : arena(NULL) {}
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> & other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        if (arena == NULL)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (arena == NULL)
+            ::operator delete(p);
+    }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) {
+    return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) {
+    return a.arena != b.arena;
+}
+
+/** @brief The machines of a job, in ascending id order. Up to INLINE_SIZE ids 
+ *         are kept sorted in the object itself, a larger set switches to a 
+ *         bitmap over the machine ids, so a set is never a tree of nodes.
+ */
+class MachineSet {
+private:
+    static const int INLINE_SIZE = 8;
+
+    /** @brief The sorted ids, while the set is not a bitmap */
+    int32_t inlineIds[INLINE_SIZE];
+
+    /** @brief Bit id % 64 of word id / 64 is set if id is in the set, empty if not used */
+    std::vector<uint64_t> bits;
+
+    /** @brief The number of ids in the set */
+    int count;
+
+    int NextBit(int from) const;
+
+public:
+    /** @brief Iterate the ids in ascending order */
+    class const_iterator {
+    private:
+        const MachineSet* set;
+
+        /** @brief The index in inlineIds, or the id itself for a bitmap */
+        int pos;
+
+    public:
+        const_iterator(const MachineSet* set, int pos);
+
+        int32_t operator*() const;
+
+        const_iterator & operator++();
+
+        bool operator==(const const_iterator & other) const;
+
+        bool operator!=(const const_iterator & other) const;
+    };
+    typedef const_iterator iterator;
+
+    MachineSet();
+
+    void Insert(int32_t id);
+
+    bool Erase(int32_t id);
+
+    bool Contains(int32_t id) const;
+
+    int Size() const;
+
+    bool Empty() const;
+
+    void Clear();
+
+    void Swap(MachineSet & other);
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    std::set<int32_t> ToSet() const;
+};
+
+/** @brief The source of the current time of the scheduler. The server runs on the
+ *         wall clock, a replay sets a virtual clock to the time of its events. 
+ */
+class Clock {
+public:
+    virtual ~Clock() {}
+
+    /** @brief Get the current time.
+     *  @return The time in seconds
+     */
+    virtual time_t Now() const = 0;
+
+    static Clock* Wall();
+};
+
+/** @brief The time of the system */
+class WallClock : public Clock {
+public:
+    time_t Now() const;
+};
+
+/** @brief A time that only moves when it is set */
+class VirtualClock : public Clock {
+private:
+    /** @brief The current time */
+    time_t now;
+
+public:
+    VirtualClock(time_t now);
+
+    time_t Now() const;
+
+    void Set(time_t now);
+
+    void Advance(time_t seconds);
+};
+
 class MyJob {
 public:
     /** @brief The job id. */
@@ -64,24 +257,35 @@ public:
     /** @brief The arrive and start time of the job. */
     time_t arriveTime, startTime;
 
+    /** @brief The finish time of a started job, the key of the running queue. */
+    time_t finishTime;
+
     /** @brief True if the job is allocated to preferrd resources, else false. */
     bool isPrefered;
 
     /** @brief The set of machines that allocate to the job. */
-    std::set<int32_t> assignedMachines;
+    MachineSet assignedMachines;
+
+    /** @brief The position of the job in its RunningHeap, -1 if not in one. */
+    int heapIndex;
+
+    /** @brief The row of the job in its PendingTable, -1 if not in one. */
+    int pendingIndex;
 
     MyJob(JobID jobId, job_t::type jobType, int32_t k, double duration, 
                 double slowDuration, time_t arriveTime);
     
     MyJob(MyJob* job);
     
-    void Start(std::set<int32_t> & machines, bool isPrefered);
+    void Start(const MachineSet & machines, bool isPrefered, time_t startTime);
     
     void FreeMachine(int machineID);
     
     bool IsFinished();
     
     double CalUtility(time_t curTime, bool isPrefered);
+
+    void UpdateFinishTime();
     
     time_t GetFinishedTime();
 };
@@ -103,76 +307,989 @@ public:
     bool IsFree();
 };
 
+/** @brief The layout of the racks. Machine ids are numbered rack by rack, 
+ *         the index maps an id to its rack and its slot in the rack.
+ */
+class Topology {
+private:
+    /** @brief The id of the first machine of every rack, the number of machines last */
+    std::vector<int> rackOffsets;
+
+    /** @brief The rack of every machine */
+    std::vector<int> machineRacks;
+
+    /** @brief The max number of machines on the same rack */
+    int maxMachinesPerRack;
+
+public:
+    Topology();
+
+    Topology(const std::vector<int> & rackSizes);
+
+    int GetRackNum() const;
+
+    int GetMachineNum() const;
+
+    int GetMaxMachinesPerRack() const;
+
+    int GetRack(int id) const;
+
+    int GetSlot(int id) const;
+
+    int GetMachineID(int rack, int slot) const;
+};
+
+/** @brief The pending jobs in arrival order, indexed by job id. */
+class PendingQueue {
+private:
+    /** @brief The jobs in arrival order */
+    std::list<MyJob*> jobs;
+
+    /** @brief The position of every job in jobs */
+    std::unordered_map<JobID, std::list<MyJob*>::iterator> index;
+
+public:
+    typedef std::list<MyJob*>::const_iterator const_iterator;
+
+    void PushBack(MyJob* job);
+
+    MyJob* Front() const;
+
+    void PopFront();
+
+    MyJob* Find(JobID jobId) const;
+
+    bool Erase(JobID jobId);
+
+    bool Empty() const;
+
+    size_t Size() const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    const std::list<MyJob*> & GetList() const;
+};
+
 /** @brief A comparator used for priority queue(runningjoblist) 
  *         based on the finish time of the job. 
  */
 struct JobComparison {
     bool operator() (const MyJob* job1, const MyJob* job2) const {
-        int endTime1, endTime2;
-        double duration;
-        duration = job1->isPrefered ? job1->duration : job1->slowDuration;
-        endTime1 = (job1->startTime) + (int)duration;
-     
-        duration = job2->isPrefered ? job2->duration : job2->slowDuration;
-        endTime2 = (job2->startTime) + (int)duration;
-         
-        return endTime1 > endTime2;
+        // Break ties on the job id so the pop order does not depend on
+        // the layout of the heap.
+        if (job1->finishTime != job2->finishTime)
+            return job1->finishTime > job2->finishTime;
+        return job1->jobId > job2->jobId;
     }
  };
 
+/** @brief The running jobs, a 4-ary heap ordered by JobComparison with the
+ *         job that finishes first on the top. Every job keeps its position 
+ *         in heapIndex, so it can be removed from anywhere in O(log n).
+ *         A job can be in one heap at a time.
+ */
+class RunningHeap {
+private:
+    static const size_t ARITY = 4;
+
+    /** @brief The jobs in heap order */
+    std::vector<MyJob*> jobs;
+
+    void Place(MyJob* job, size_t pos);
+
+    void SiftUp(size_t pos);
+
+    void SiftDown(size_t pos);
+
+public:
+    void Push(MyJob* job);
+
+    MyJob* Top() const;
+
+    MyJob* Pop();
+
+    void Erase(MyJob* job);
+
+    void Build(const std::vector<MyJob*> & jobs);
+
+    void Rebuild();
+
+    bool Empty() const;
+
+    size_t Size() const;
+
+    const std::vector<MyJob*> & GetJobs() const;
+
+    void Clear();
+};
+
+
+/** @brief A fixed size cache from a search state to the best utility that
+ *         the search can still get from that state.
+ */
+class TranspositionTable {
+private:
+    struct Entry {
+        /** @brief The full state key, 0 if the entry is empty */
+        uint64_t key;
+
+        /** @brief The best utility from the state */
+        double utility;
+    };
+
+    /** @brief The entries, the size is a power of 2 */
+    std::vector<Entry> entries;
+
+    /** @brief entries.size() - 1 */
+    uint64_t mask;
+
+    /** @brief Locks for the entries, entry i is guarded by locks[i % LOCK_NUM] */
+    static const int LOCK_NUM = 64;
+    std::mutex locks[LOCK_NUM];
+
+public:
+    /** @brief The number of probes that found / did not find the state */
+    std::atomic<uint64_t> hits, misses;
+
+    TranspositionTable(size_t memoryBudget);
+
+    static uint64_t HashKey(uint64_t kind, uint64_t a, uint64_t b);
+
+    bool Probe(uint64_t key, double & utility);
+
+    void Store(uint64_t key, double utility);
+
+    void Clear();
+};
+
+/** @brief A bounded cache of job placements. Which racks a placement takes its 
+ *         machines from, and how many from each, only depends on the free 
+ *         machines per rack, the job type and k. The cache keeps that split by a 
+ *         key of the three, the machines are picked again from the rack bitmaps.
+ *         It is used by one thread.
+ */
+class PlacementCache {
+public:
+    /** @brief The most racks a cached placement can take machines from */
+    static const int MAX_RACKS = 8;
+
+    struct Entry {
+        /** @brief The key of the free counts, type and k, 0 if the entry is empty */
+        uint64_t key;
+
+        /** @brief true if the placement is preferred by the job */
+        bool isPrefered;
+
+        /** @brief The number of racks used */
+        int rackNum;
+
+        /** @brief The racks and the number of machines taken from each */
+        int32_t racks[MAX_RACKS];
+        int32_t counts[MAX_RACKS];
+    };
+
+private:
+    /** @brief The entries, allocated on the first Store. The size is a power of 2 */
+    std::vector<Entry> entries;
+
+    /** @brief The number of entries */
+    size_t size;
+
+public:
+    PlacementCache(size_t size);
+
+    const Entry* Probe(uint64_t key) const;
+
+    void Store(const Entry & entry);
+
+    void Clear();
+};
+
+/** @brief The exact packer of one decision: which pending jobs to start now, and
+ *         on which racks, for the highest total utility. A GPU job prefers k 
+ *         machines of the GPU rack 0, an MPI job k machines of one rack, any other 
+ *         k machines give the slow utility. The utility only depends on the free 
+ *         machines per rack, so a dynamic program over the jobs and the free counts
+ *         finds the best packing. The racks other than 0 are only told apart by 
+ *         their free count, so a state keeps them sorted. The machines of the 
+ *         jobs on any machines are only counted, any free ones will do.
+ */
+class ExactPacker {
+public:
+    /** @brief The choices of a job besides the rack of a preferred one */
+    enum Choice { PACK_SKIP = -2, PACK_ANY = -1 };
+
+    struct Item {
+        job_t::type jobType;
+        int k;
+
+        /** @brief The utility on preferred and on other machines */
+        double preferedUtility, slowUtility;
+    };
+
+private:
+    struct Memo {
+        /** @brief The best utility of the jobs from the state on */
+        double utility;
+
+        /** @brief The choice of the job of the state: PACK_SKIP, PACK_ANY, 0 for 
+         *         the GPU rack, c + 1 for a rack with c free machines
+         */
+        int choice;
+    };
+
+    /** @brief true if the jobs may start on machines they do not prefer */
+    bool isSoft;
+
+    /** @brief The most states to memoise before giving up */
+    size_t maxStates;
+
+    /** @brief The jobs of the current Pack */
+    const std::vector<Item>* items;
+
+    /** @brief The best packing of every state seen, by the job index and the 
+     *         free counts 
+     */
+    std::unordered_map<std::string, Memo> memo;
+
+    /** @brief true if the states went over maxStates */
+    bool overflow;
+
+    std::string StateKey(int index, int gpuFree, int reserved, const std::vector<int> & free) const;
+
+    double Solve(int index, int gpuFree, int reserved, std::vector<int> & free);
+
+public:
+    ExactPacker();
+
+    bool Pack(const std::vector<int> & freeCounts, const std::vector<Item> & items, 
+                    bool isSoft, size_t maxStates, std::vector<int> & choices);
+};
+
+/** @brief A thread pool where every worker has its own task queue, and 
+ *         steals from the other queues when its own one is empty.
+ */
+class ThreadPool {
+private:
+    struct Worker {
+        /** @brief Guards tasks */
+        std::mutex lock;
+
+        /** @brief The owner takes from the back, thieves from the front */
+        std::deque<std::function<void()> > tasks;
+    };
+
+    std::vector<Worker*> workers;
+
+    std::vector<std::thread> threads;
+
+    /** @brief Guards the fields below, used with wakeup and done */
+    std::mutex stateLock;
+    std::condition_variable wakeup, done;
+
+    /** @brief The number of tasks not finished / not started yet */
+    int pendingTasks, queuedTasks;
+
+    /** @brief The worker that receives the next submitted task */
+    unsigned int nextWorker;
+
+    bool stopping;
+
+    bool RunOne(int self);
+
+    void WorkerLoop(int index);
+
+public:
+    ThreadPool(int threadNum);
+
+    ~ThreadPool();
+
+    int Size();
+
+    void Submit(const std::function<void()> & task);
+
+    void Wait();
+};
+
+/** @brief How Cluster::Schedule() explores the delay decisions */
+enum SearchMode {
+    /** @brief Search every delay choice at every step */
+    SEARCH_EXHAUSTIVE,
+
+    /** @brief Keep only the best beamWidth partial schedules at every step */
+    SEARCH_BEAM,
+
+    /** @brief Monte Carlo tree search over sampled job durations */
+    SEARCH_MCTS
+};
+
+/** @brief How a search decision picks the pending jobs to start */
+enum PackingPolicy {
+    /** @brief The job with the highest utility first, while the machines last */
+    PACK_GREEDY,
+
+    /** @brief The set of jobs with the highest total utility, by ExactPacker */
+    PACK_EXACT
+};
+
+/** @brief The parameters of the N-step search */
+struct SearchParams {
+    /** @brief How the delay decisions are explored */
+    SearchMode mode;
+
+    /** @brief The number of partial schedules kept per step in beam mode */
+    int beamWidth;
+
+    /** @brief The number of rollouts of one Schedule() in MCTS mode */
+    int mctsIterations;
+
+    /** @brief The standard deviation of the sampled durations in MCTS mode, 
+     *         relative to the expected durations 
+     */
+    double durationPerturbStd;
+
+    /** @brief The number of running jobs to look ahead, the search ends when 
+     *         the last of them finishes 
+     */
+    int horizon;
+
+    /** @brief The maximum number of search steps */
+    int depth;
+
+    /** @brief The number of search steps when the pending queue is long */
+    int minDepth;
+
+    /** @brief The depth drops by one for every queueLenPerStep pending jobs, 
+     *         0 to always search depth steps 
+     */
+    int queueLenPerStep;
+
+    /** @brief The wall-clock budget of one Schedule() in ms, 0 for no limit */
+    int timeBudgetMs;
+
+    /** @brief How the exhaustive and beam searches pick the jobs of a decision. 
+     *         MCTS rollouts are always greedy.
+     */
+    PackingPolicy packing;
+
+    /** @brief The most states the exact packer looks at for one decision, the 
+     *         decision is greedy beyond 
+     */
+    int exactPackStates;
+};
+
+/** @brief One future decision of a searched plan */
+struct PlanStep {
+    /** @brief The job whose finish triggers the decision */
+    int finishedJobId;
+
+    /** @brief The time the search expected the job to finish at */
+    time_t finishTime;
+
+    /** @brief The jobs to start, same format as the result of Cluster::Schedule() */
+    std::vector<std::vector<int> > decision;
+};
+
+/** @brief Counters of one N-step search */
+struct SearchStats {
+    /** @brief The number of Search calls */
+    uint64_t expandedNodes;
+
+    /** @brief The number of branches cut by the utility upper bound */
+    uint64_t prunedBranches;
+
+    /** @brief The deepest search that finished before the deadline, 0 if only 
+     *         the greedy decision finished 
+     */
+    int completedDepth;
+
+    /** @brief true if the deadline stopped a search */
+    bool timedOut;
+
+    /** @brief The number of placements found / not found in the placement cache */
+    uint64_t placementHits, placementMisses;
+
+    /** @brief The number of decisions packed exactly / left to greedy because 
+     *         the exact packer had too many states 
+     */
+    uint64_t exactPacks, exactPackFallbacks;
+};
+
+/** @brief The job lists of a cluster, with the nodes on its arena */
+typedef std::list<MyJob*, ArenaAllocator<MyJob*> > JobList;
+
+/** @brief The jobs pending in a cluster as columns, one row per job in job id 
+ *         order. A started job keeps its row but no longer fits, so the rows 
+ *         stay put during the search. The utilities of all rows are computed 
+ *         in one vector pass, with AVX2 if the CPU has it, to order the rows of 
+ *         every shape.
+ */
+class PendingTable {
+public:
+    /** @brief The utilities the rows of a shape are ordered by: on preferred 
+     *         machines, on other machines, and the best of the two 
+     */
+    enum Order { ORDER_PREFERED = 0, ORDER_SLOW = 1, ORDER_BEST = 2, ORDER_NUM = 3 };
+
+private:
+    /** @brief The arrive time, fast duration and slow duration of every job */
+    std::vector<double> arriveTimes, durations, slowDurations;
+
+    /** @brief The number of machines of a pending job, infinity for a started one */
+    std::vector<double> fitKs;
+
+    /** @brief The number of machines and the type of every job */
+    std::vector<int32_t> ks;
+    std::vector<int32_t> types;
+
+    /** @brief The job of every row, and its node in the pending list */
+    std::vector<MyJob*> jobs;
+    std::vector<JobList::iterator> nodes;
+
+    /** @brief The shape of every job. Jobs of the same type and k have the same 
+     *         shape, they get the same machines from the same free machines.
+     */
+    std::vector<int> shapes;
+
+    /** @brief The rows of every shape, the ones after shapeNum are kept to reuse 
+     *         the memory 
+     */
+    std::vector<std::vector<int> > shapeRows;
+
+    /** @brief The number of shapes */
+    int shapeNum;
+
+    /** @brief The utility of every job on preferred and on other machines, at the 
+     *         time of the last ComputeUtility 
+     */
+    std::vector<double> preferedUtility, slowUtility;
+
+    /** @brief The latest arrive time of the jobs. From then on every job waits, 
+     *         so the order of the utilities does not change with the time.
+     */
+    double orderTime;
+
+    /** @brief The utilities of every row at orderTime, at row * ORDER_NUM + order */
+    std::vector<double> orderUtility;
+
+    /** @brief The rows of every shape by utility, highest first, at shape * ORDER_NUM + order.
+     *         The ones after shapeNum * ORDER_NUM are kept to reuse the memory.
+     */
+    std::vector<std::vector<int> > shapeOrders;
+
+    /** @brief The first row of every shape order not started since ResetHeads */
+    std::vector<unsigned int> heads;
+
+    void SortShapes();
+
+    void ComputeUtility(double curTime);
+
+    double CalUtility(int row, int order, double curTime) const;
+
+public:
+    void Build(JobList & pendingJobList);
+
+    void SetPending(MyJob* job, bool isPending);
+
+    void Refresh();
+
+    int GetShape(int row) const;
+
+    int GetShapeNum() const;
+
+    void ResetHeads();
+
+    int GetHead(int shape, Order order, time_t curTime, double & utility);
+
+    job_t::type GetShapeType(int shape) const;
+
+    int GetShapeK(int shape) const;
+
+    job_t::type GetType(int row) const;
+
+    int GetK(int row) const;
+
+    JobList::iterator GetNode(int row) const;
+};
 
 class Cluster {
 private:
+    /** @brief A partial schedule kept by the beam search */
+    struct BeamNode {
+        /** @brief The jobs started at every searched step, from the first one */
+        std::vector<std::vector<std::vector<int> > > decisions;
+
+        /** @brief The job that finishes after each step */
+        std::vector<int> finishedJobs;
+
+        /** @brief The time of each step after the first one */
+        std::vector<time_t> finishTimes;
+
+        /** @brief The utility of the started jobs */
+        double utility;
+
+        /** @brief The utility plus an estimate of the next step, used to rank nodes */
+        double score;
+
+        /** @brief The time of the next step */
+        time_t time;
+
+        /** @brief The end job of the search, -1 once it finished */
+        int searchEndJobId;
+    };
+
+    /** @brief A node of the Monte Carlo search tree. The tree is open loop: 
+     *         a node is reached by a sequence of delay counts, whatever the 
+     *         sampled durations were.
+     */
+    struct MctsNode {
+        /** @brief The number of rollouts through the node */
+        int visits;
+
+        /** @brief The total utility of these rollouts */
+        double value;
+
+        /** @brief The node reached by delaying i jobs at this step, -1 if not expanded */
+        std::vector<int> children;
+    };
+
+    /** @brief A reversible change to the search state, kept in the undo log */
+    struct SearchOp {
+        enum Kind {
+            ALLOCATE,       /* machines allocated to a job */
+            FREE,           /* machines of a job freed */
+            POP_RUNNING,    /* job popped from runningJobList */
+            PUSH_RUNNING,   /* job pushed to runningJobList */
+            START_PENDING,  /* job moved from pendingJobList to startedJobList */
+            DELAY_PENDING   /* job moved from startedJobList to pendingJobList */
+        } kind;
+
+        /** @brief The job that is changed */
+        MyJob* job;
+
+        /** @brief The list node of the job and the node it was in front of */
+        JobList::iterator node, next;
+
+        /** @brief The machines freed by FREE */
+        MachineSet machines;
+
+        /** @brief The start time, finish time and preference overwritten by ALLOCATE */
+        time_t startTime, finishTime;
+        bool isPrefered;
+    };
+
     /** @brief true if the policy is soft, else false */
     bool isSoft;
 
+    /** @brief The buffers of one Search level, reused by every node at the same depth */
+    struct SearchFrame {
+        /** @brief The jobs started by the greedy decision, in the order they are picked */
+        std::vector<MyJob*> potentialRunningJobs;
+
+        /** @brief The utility of each of these jobs */
+        std::vector<double> potentialUtility;
+    };
+
+    /** @brief The first level branches of SearchParallel, each searched on its own
+     *         copy of the cluster by the thread pool
+     */
+    struct SearchBranch {
+        /** @brief The copy of the cluster, kept for the next decisions */
+        Cluster* cluster;
+
+        /** @brief The jobs the branch starts, in the format of Schedule */
+        std::vector<std::vector<int> > result;
+
+        /** @brief The future decisions of the branch */
+        std::vector<PlanStep> plan;
+
+        /** @brief The utility of the started jobs and its upper bound after them */
+        double utility, bound;
+
+        /** @brief The utility SimulateNext finds after the started jobs */
+        double nextResultUtility;
+
+        /** @brief The arguments of SimulateNext */
+        int step, searchEndJobId;
+        time_t curTime;
+        bool hasPlan;
+    };
+
+    /** @brief The memory of the jobs of a copy made by Cluster(Cluster*), which 
+     *         is used by another thread
+     */
+    Arena ownArena;
+
+    /** @brief The memory of the jobs and list nodes, NULL to use the heap */
+    Arena* arena;
+
     /** @brief The list for job that waiting for allocating resources */
-    std::list<MyJob*> pendingJobList;
+    JobList pendingJobList;
+
+    /** @brief The jobs taken from pendingJobList by the search levels in progress */
+    JobList startedJobList;
+
+    /** @brief The columns of the jobs in pendingJobList and startedJobList */
+    PendingTable pendingTable;
 
     /** @brief The list for job that running */
-    std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> runningJobList;
+    RunningHeap runningJobList;
+
+    /** @brief The changes made by the search levels in progress, latest last */
+    std::vector<SearchOp> undoLog;
+
+    /** @brief The running jobs while they are copied or freed, kept to reuse the memory */
+    std::vector<MyJob*> jobBuffer;
+
+    /** @brief The decision of the last Schedule, and the one of the depth in progress 
+     *         with a time budget
+     */
+    std::vector<std::vector<int> > decision, depthDecision;
+
+    /** @brief The rows dropped from the decisions, kept to reuse the memory */
+    std::vector<std::vector<int> > spareRows;
+
+    /** @brief The branches of the last SearchParallel, kept to reuse the copies */
+    std::vector<SearchBranch> branches;
+
+    /** @brief Zobrist hash of machine owners, pending jobs and running jobs */
+    uint64_t stateHash;
+
+    /** @brief The cache of searched states, NULL if not used */
+    TranspositionTable* table;
+
+    /** @brief The threads that search the first level branches, NULL to search them in order */
+    ThreadPool* pool;
+
+    /** @brief The time the decision is made at */
+    const Clock* clock;
+
+    /** @brief The number of machines in all racks */
+    int totalMachines;
+
+    /** @brief The counters of the search */
+    SearchStats stats;
+
+    /** @brief The depth, horizon and time budget of the search */
+    SearchParams params;
+
+    /** @brief true if the search stops at deadline */
+    bool hasDeadline;
+
+    /** @brief When the search has to stop */
+    std::chrono::steady_clock::time_point deadline;
+
+    /** @brief The Monte Carlo search tree of this cluster, the root first */
+    std::vector<MctsNode> mctsTree;
+
+    /** @brief The largest rollout utility seen, to scale utilities for UCT */
+    double mctsMaxValue;
+
+    /** @brief The greedy jobs of the root of the Monte Carlo search tree at the 
+     *         expected durations, with their machines and if they are preferred. 
+     *         Delaying i jobs at the root delays the last i of them.
+     */
+    std::vector<MyJob*> mctsRootJobs;
+    std::vector<MachineSet> mctsRootMachines;
+    std::vector<bool> mctsRootPrefered;
+
+    bool IsTimeUp();
+
+    int GetSearchDepth();
 
     /** @brief The racks and machines array */
     std::vector<std::vector<MyMachine> > racks;
 
     /** @brief The max number of machines on the same rack */
     int maxMachinesPerRack;
+
+    /** @brief The rack layout, shared with the server and the other copies */
+    const Topology* topology;
+
+    /** @brief Bit i of word i / 64 of a rack is set if machine i of the rack is free */
+    std::vector<std::vector<uint64_t> > freeBitmaps;
+
+    /** @brief The number of free machines of every rack */
+    std::vector<int> freeCounts;
+
+    /** @brief The number of free machines in all racks */
+    int freeMachineNum;
+
+    /** @brief Bucket c is a bitmap of the racks with c free machines */
+    std::vector<std::vector<uint64_t> > rackBuckets;
+
+    /** @brief The number of racks in every bucket */
+    std::vector<int> bucketSizes;
+
+    /** @brief Zobrist hash of the free count of every rack */
+    uint64_t freeCountHash;
+
+    /** @brief The key of rack r with c free machines, at r * (maxMachinesPerRack + 1) + c */
+    std::vector<uint64_t> freeCountKeys;
+
+    /** @brief The placements found on the free counts seen so far */
+    PlacementCache placementCache;
+
+    /** @brief The racks taken out of the buckets while picking machines, kept to reuse the memory */
+    std::vector<int> emptiedRacks;
+
+    /** @brief For every shape of the pending table, -1 if GreedyStart did not place 
+     *         it on the current free machines yet, -2 if its job type gets no 
+     *         machines, 1 if it got preferred machines, else 0. Kept to reuse the 
+     *         memory.
+     */
+    std::vector<int> shapePlacements;
+
+    /** @brief The machines every placed shape gets */
+    std::vector<MachineSet> shapeMachines;
+
+    /** @brief The buffers of the Search levels, by depth */
+    std::deque<SearchFrame> frames;
+
+    /** @brief The number of Search levels in progress */
+    size_t frameDepth;
+
+    /** @brief The packer of PACK_EXACT, kept to reuse the memory */
+    ExactPacker exactPacker;
+
+    /** @brief The jobs that fit in UtilityUpperBound, kept to reuse the memory. 
+     *         Each element is <utility per machine, <utility, k> >.
+     */
+    std::vector<std::pair<double, std::pair<double, int> > > boundJobs;
     
     MyMachine* GetMachineByID(unsigned int id);
 
+    void InitFreeMachines();
+
+    void MoveRackBucket(int rack, int from, int to);
+
+    void AssignMachine(int id, MyJob* job);
+
+    void FreeMachine(int id);
+
     int GetFreeMachinesNum();
 
-    void AllocateMachinesToJob(MyJob* job, std::set<int32_t> & machines, bool isPrefered);
+    void AllocateMachinesToJob(MyJob* job, const MachineSet & machines, bool isPrefered, 
+                                                                    time_t startTime);
 
     void FreeMachinesByJob(MyJob* job);
 
-    std::vector<int> GetFreeMachines();
+    void PushRunningJob(MyJob* job);
+
+    MyJob* PopRunningJob();
+
+    void StartPendingJob(JobList::iterator jobIter);
 
-    void GetMachineByRack(std::set<int> & machines, int k, int index);
+    void DelayLastStartedJob();
 
-    int FindMinRack(std::vector<int> & freeMachines);
+    void Rollback(size_t checkpoint);
 
-    bool GetMachinesForMPI(std::set<int> & machines, int k);
+    int FindBestFitRack(int k);
 
-    bool GetMachinesForGPU(std::set<int> & machines, int k);
+    void GetMachinesFromMinRacks(MachineSet & machines, int k);
 
-    bool GetBestMachines(job_t::type jobType, int k, std::set<int32_t> &machines);
+    void GetMachineByRack(MachineSet & machines, int k, int index);
 
-    std::vector<std::vector<int> > Search(int step, int searchEndJobId, time_t curTime, double & resultUtility);
+    int FindMinRack();
 
-    std::vector<std::vector<int> > SimulateNext(int step, int searchEndJobId, time_t curTime, double & resultUtility);
+    bool GetMachinesForMPI(MachineSet & machines, int k);
 
-    std::vector<std::vector<int> > constructResult(std::vector<MyJob*> & jobs);
+    bool GetMachinesForGPU(MachineSet & machines, int k);
+
+    bool GetBestMachines(job_t::type jobType, int k, MachineSet &machines);
+
+    double UtilityUpperBound(time_t curTime, int capacity);
+
+    double BranchUpperBound(int step, int searchEndJobId, time_t curTime);
+
+    bool PlaceShape(int shape);
+
+    void GreedyStart(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                        std::vector<double> & potentialUtility);
+
+    bool ExactStart(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                        std::vector<double> & potentialUtility);
+
+    void StartJobs(time_t curTime, std::vector<MyJob*> & potentialRunningJobs,
+                                        std::vector<double> & potentialUtility);
+
+    static double SumUtility(const std::vector<double> & utility);
+
+    SearchFrame & PushFrame();
+
+    void SearchParallel(int step, int searchEndJobId, time_t curTime, double & resultUtility,
+                std::vector<std::vector<int> > & result, std::vector<PlanStep>* plan);
+
+    void Search(int step, int searchEndJobId, time_t curTime, double & resultUtility,
+                std::vector<std::vector<int> >* result, std::vector<PlanStep>* plan);
+
+    void ReplayBeamNode(BeamNode & node, time_t curTime);
+
+    std::vector<std::vector<int> > BeamSearch(int step, int searchEndJobId, time_t curTime, 
+                                            double & resultUtility, std::vector<PlanStep>* plan);
+
+    double MctsRollout(int node, int step, int searchEndJobId, time_t curTime, 
+                                            std::vector<int> & path);
+
+    void MctsWorker(int iterations, unsigned int seed, int step, int searchEndJobId, time_t curTime);
+
+    std::vector<std::vector<int> > MctsSearch(int step, int searchEndJobId, time_t curTime, 
+                                            double & resultUtility);
+
+    void SimulateNext(int step, int searchEndJobId, time_t curTime, double & resultUtility,
+                                                                    std::vector<PlanStep>* plan);
+
+    void constructResult(std::vector<MyJob*> & jobs, std::vector<std::vector<int> > & result);
+
+    void ResizeResult(std::vector<std::vector<int> > & result, size_t size);
+
+    MyJob* CopyJob(MyJob* job);
+
+    void DestroyJob(MyJob* job);
 
 public:
     Cluster(std::vector<std::vector<MyMachine> > & racks, 
-            std::list<MyJob*> & pendingJobList,
-            std::priority_queue<MyJob*, std::vector<MyJob*>, JobComparison> & runningJobList,
-            int maxMachinesPerRack, bool isSoft);
+            const std::list<MyJob*> & pendingJobList,
+            const RunningHeap & runningJobList, const Topology* topology, bool isSoft,
+            Arena* arena);
+
+    Cluster(Cluster* cluster);
+
+    ~Cluster();
+
+    void Load(std::vector<std::vector<MyMachine> > & racks, 
+            const std::list<MyJob*> & pendingJobList,
+            const RunningHeap & runningJobList, bool isSoft);
+
+    void Load(Cluster* cluster);
 
     void Clear();
 
-    std::vector<std::vector<int> > Schedule();
+    void SetTranspositionTable(TranspositionTable* table);
+
+    void SetThreadPool(ThreadPool* pool);
+
+    void SetClock(const Clock* clock);
+
+    void SetSearchParams(const SearchParams & params);
+
+    SearchStats GetStats();
+
+    const std::vector<std::vector<int> > & Schedule(std::vector<PlanStep>* plan);
+};
+
+/** @brief The state and the policies of the scheduler, fed by the events of the 
+ *         server or of a replay. The jobs it starts are passed to a callback.
+ */
+class Scheduler {
+private:
+    /** @brief Policy using for the scheduler, default is soft */
+    enum {
+        none,
+        hard,
+        soft,
+        beam,
+        mcts
+    } policy;
+
+    /** @brief The list for job that waiting for allocating resources */
+    PendingQueue pendingJobList;
+
+    /** @brief The list for job that running */
+    RunningHeap runningJobList;
+
+    /** @brief The racks and machines array */
+    std::vector<std::vector<MyMachine> > racks;
+
+    /** @brief The max number of machines on the same rack */
+    int maxMachinesPerRack;
+
+    /** @brief The index from machine id to rack and slot */
+    Topology topology;
+
+    /** @brief The memory of the jobs copied for a schedule, reset after each one */
+    Arena arena;
+
+    /** @brief The snapshot searched by every schedule, NULL before the first one. It 
+     *         is loaded again for each schedule, so its memory is reused.
+     */
+    Cluster* cluster;
+
+    /** @brief The memory budget of the transposition table in MB */
+    int tableMemoryMB;
+
+    /** @brief The cache of searched states, kept across schedules */
+    TranspositionTable* table;
+
+    /** @brief The number of threads that search, including the caller thread */
+    int searchThreads;
+
+    /** @brief The depth, horizon and time budget of the search */
+    SearchParams searchParams;
+
+    /** @brief The future decisions of the last search, one per expected job finish */
+    std::vector<PlanStep> plan;
+
+    /** @brief The plan step for the next job finish */
+    unsigned int nextPlanStep;
+
+    /** @brief The plan steps applied since the last search */
+    int reusedPlanSteps;
+
+    /** @brief The most plan steps applied in a row before searching again, 0 to 
+     *         search on every event 
+     */
+    int planReuseSteps;
+
+    /** @brief The workers that help the caller thread search, NULL if searchThreads is 1 */
+    ThreadPool* pool;
+
+    /** @brief The time of the events, the wall clock unless the events are replayed */
+    Clock* clock;
+
+    /** @brief Called with every job started and its machines */
+    std::function<void(int, const MachineSet &)> allocResources;
+
+    std::vector<int> ReadConfigFile(const char* configFilePath);
+
+    MyMachine* GetMachineByID(uint32_t id);
+
+    void AllocateBestMachines(MyJob* job, MachineSet & machines);
+
+    int GetRandomFreeMachine();
+
+    int GetFreeMachinesNum();
+
+    void printRackInfo();
+
+    void printJobInfo();
+
+    MyJob* getPendingJobByID(int jobID);
+
+    void Schedule();
+
+    void ApplySchedule(const std::vector<std::vector<int> > & schedule);
+
+    bool ApplyPlanStep(int finishedJobId);
+
+public:
+    Scheduler(const char* configFilePath, Clock* clock, 
+                const std::function<void(int, const MachineSet &)> & allocResources);
+
+    ~Scheduler();
+
+    void AddJob(const JobID jobId, const job_t::type jobType, const int32_t k, 
+                const int32_t priority, const double duration, 
+                const double slowDuration);
+
+    void FreeResources(const std::set<int32_t> & machines);
+
+    void SetSearchParams(const int32_t depth, const int32_t horizon, 
+                const int32_t timeBudgetMs);
+
+    const Topology & GetTopology() const;
 };
 
 #endif
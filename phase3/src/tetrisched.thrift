@@ -16,6 +16,7 @@ enum job_t {
 service TetrischedService {
     void AddJob(1:JobID jobId, 2:job_t jobType, 3:i32 k, 4:i32 priority, 5:double duration, 6:double slowDuration),
     void FreeResources(1:set<i32> machines),
+    void SetSearchParams(1:i32 depth, 2:i32 horizon, 3:i32 timeBudgetMs),
 }
 
 service YARNTetrischedService {